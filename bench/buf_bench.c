@@ -0,0 +1,125 @@
+#define _GNU_SOURCE
+
+#include "buf.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+
+// Counts every realloc and mremap buf.c makes, through the linker's
+// --wrap. BENCH_NO_TRIM builds against a buf.c that predates buf_trim.
+
+void *__real_realloc(void *ptr, size_t size);
+void *__real_mremap(void *old, size_t old_size, size_t size, int flags, ...);
+
+static size_t g_resizes;
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	g_resizes++;
+	return __real_realloc(ptr, size);
+}
+
+void *__wrap_mremap(void *old, size_t old_size, size_t size, int flags, ...)
+{
+	g_resizes++;
+	return __real_mremap(old, old_size, size, flags);
+}
+
+int gc_error(void)
+{
+	perror("buf_bench");
+	return 1;
+}
+
+static void trim(Weft_Buf **buf_p)
+{
+#ifndef BENCH_NO_TRIM
+	buf_trim(buf_p);
+#else
+	(void)buf_p;
+#endif
+}
+
+static double get_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, double start, Weft_Buf *buf)
+{
+	printf("%-8s %10zu resizes %8.3f s   final cap %zu\n",
+	       name,
+	       g_resizes,
+	       get_time() - start,
+	       buf_get_cap(buf));
+}
+
+// A stack hovering around a quarter of its capacity, as a data stack does
+// between calls. A trim stands in for each collection.
+static void bench_hover(void)
+{
+	const size_t ROUNDS = 1000000;
+	const size_t DEPTH = 64;
+	const size_t SWING = 60;
+	const size_t TRIM_EVERY = 1000;
+
+	Weft_Buf *buf = new_buf(sizeof(size_t));
+	g_resizes = 0;
+	double start = get_time();
+	for (size_t i = 0; i < DEPTH; i++) {
+		buf_push_size(&buf, i);
+	}
+
+	for (size_t round = 0; round < ROUNDS; round++) {
+		for (size_t i = 0; i < SWING; i++) {
+			buf_pop_size(&buf);
+		}
+		for (size_t i = 0; i < SWING; i++) {
+			buf_push_size(&buf, i);
+		}
+		if (round % TRIM_EVERY == 0) {
+			trim(&buf);
+		}
+	}
+	report("hover", start, buf);
+	delete_buf(buf);
+}
+
+// Deep bursts that drain completely, then a quiet tail. The buf should
+// keep its capacity across bursts and give it back once idle.
+static void bench_burst(void)
+{
+	const size_t BURSTS = 200;
+	const size_t DEPTH = 30000;
+	const size_t IDLE_TRIMS = 8;
+
+	Weft_Buf *buf = new_buf(sizeof(size_t));
+	g_resizes = 0;
+	double start = get_time();
+	for (size_t burst = 0; burst < BURSTS; burst++) {
+		for (size_t i = 0; i < DEPTH; i++) {
+			buf_push_size(&buf, i);
+		}
+		while (buf_get_at(buf)) {
+			buf_pop_size(&buf);
+		}
+		trim(&buf);
+	}
+
+	for (size_t i = 0; i < IDLE_TRIMS; i++) {
+		trim(&buf);
+	}
+	report("burst", start, buf);
+	delete_buf(buf);
+}
+
+int main(void)
+{
+	bench_hover();
+	bench_burst();
+	return 0;
+}
@@ -0,0 +1,39 @@
+#!/bin/sh
+# Builds bench/buf_bench.c against the working tree's buf.c and, when a
+# revision is given, against that revision's buf.c, then runs both.
+#
+#   bench/buf_bench.sh [revision]
+#
+# To compare with the eager shrinking that buf_trim replaced, pass the
+# revision before it was added:
+#
+#   bench/buf_bench.sh "$(git log --format=%h --reverse -S buf_trim | head -1)~1"
+set -e
+
+cd "$(dirname "$0")/.."
+CC=${CC:-gcc}
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+build()
+{
+	$CC -O3 -I"$1" -I src $2 -o "$3" bench/buf_bench.c "$1/buf.c" \
+		-Wl,--wrap=realloc -Wl,--wrap=mremap
+}
+
+if [ -n "$1" ]; then
+	mkdir "$OUT/base"
+	git show "$1:src/buf.c" > "$OUT/base/buf.c"
+	git show "$1:src/buf.h" > "$OUT/base/buf.h"
+	if grep -q buf_trim "$OUT/base/buf.h"; then
+		build "$OUT/base" "" "$OUT/base_bench"
+	else
+		build "$OUT/base" -DBENCH_NO_TRIM "$OUT/base_bench"
+	fi
+	echo "$1:"
+	"$OUT/base_bench"
+fi
+
+build src "" "$OUT/tree_bench"
+echo "working tree:"
+"$OUT/tree_bench"
@@ -0,0 +1,107 @@
+#include "arena.h"
+#include "gc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static Weft_ArenaChunk *new_chunk(Weft_ArenaChunk *prev, size_t size)
+{
+	size_t cap = WEFT_ARENA_CHUNK_SIZE;
+	if (size > cap) {
+		cap = size;
+	}
+
+	Weft_ArenaChunk *chunk = malloc(sizeof(Weft_ArenaChunk) + cap);
+	if (!chunk) {
+		exit(gc_error());
+	}
+
+	chunk->prev = prev;
+	chunk->cap = cap;
+	chunk->at = 0;
+
+	return chunk;
+}
+
+Weft_Arena *new_arena(void)
+{
+	Weft_Arena *arena = malloc(sizeof(Weft_Arena));
+	if (!arena) {
+		exit(gc_error());
+	}
+
+	arena->chunk = new_chunk(NULL, 0);
+	arena->last = NULL;
+
+	return arena;
+}
+
+static void free_chunks(Weft_ArenaChunk *chunk)
+{
+	while (chunk) {
+		Weft_ArenaChunk *prev = chunk->prev;
+		free(chunk);
+		chunk = prev;
+	}
+}
+
+void delete_arena(Weft_Arena *arena)
+{
+	free_chunks(arena->chunk);
+	free(arena);
+}
+
+void arena_reset(Weft_Arena *arena)
+{
+	Weft_ArenaChunk *chunk = arena->chunk;
+	while (chunk->prev) {
+		Weft_ArenaChunk *prev = chunk->prev;
+		free(chunk);
+		chunk = prev;
+	}
+
+	chunk->at = 0;
+	arena->chunk = chunk;
+	arena->last = NULL;
+}
+
+static size_t align_size(size_t size)
+{
+	return (size + WEFT_ARENA_ALIGN - 1) & ~(WEFT_ARENA_ALIGN - 1);
+}
+
+void *arena_alloc(Weft_Arena *arena, size_t size)
+{
+	size = align_size(size);
+
+	Weft_ArenaChunk *chunk = arena->chunk;
+	if (chunk->cap - chunk->at < size) {
+		chunk = new_chunk(chunk, size);
+		arena->chunk = chunk;
+	}
+
+	void *ptr = chunk->raw + chunk->at;
+	chunk->at += size;
+	arena->last = ptr;
+
+	return ptr;
+}
+
+void *
+arena_realloc(Weft_Arena *arena, void *ptr, size_t size, size_t new_size)
+{
+	Weft_ArenaChunk *chunk = arena->chunk;
+	if (ptr && ptr == arena->last) {
+		size_t start = (char *)ptr - chunk->raw;
+		if (chunk->cap - start >= align_size(new_size)) {
+			chunk->at = start + align_size(new_size);
+			return ptr;
+		}
+	}
+
+	void *grown = arena_alloc(arena, new_size);
+	if (ptr) {
+		memcpy(grown, ptr, size < new_size ? size : new_size);
+	}
+	return grown;
+}
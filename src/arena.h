@@ -0,0 +1,39 @@
+#ifndef WEFT_ARENA_H
+#define WEFT_ARENA_H
+
+#include <stddef.h>
+
+// Forward Declarations
+
+typedef struct weft_arena Weft_Arena;
+typedef struct weft_arena_chunk Weft_ArenaChunk;
+
+// Constants
+
+static const size_t WEFT_ARENA_CHUNK_SIZE = 16384;
+static const size_t WEFT_ARENA_ALIGN = 16;
+
+// Data Types
+
+struct weft_arena_chunk {
+	Weft_ArenaChunk *prev;
+	size_t cap;
+	size_t at;
+	_Alignas(16) char raw[];
+};
+
+struct weft_arena {
+	Weft_ArenaChunk *chunk;
+	void *last;
+};
+
+// Functions
+
+Weft_Arena *new_arena(void);
+void delete_arena(Weft_Arena *arena);
+void arena_reset(Weft_Arena *arena);
+void *arena_alloc(Weft_Arena *arena, size_t size);
+void *
+arena_realloc(Weft_Arena *arena, void *ptr, size_t size, size_t new_size);
+
+#endif
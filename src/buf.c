@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+
 #include "buf.h"
 #include "gc.h"
 
@@ -5,20 +7,69 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
-Weft_Buf *new_buf(size_t cap)
+static bool is_large_cap(size_t cap)
 {
-	Weft_Buf *buf = malloc(sizeof(Weft_Buf) + cap);
-	if (!buf) {
+	return sizeof(Weft_Buf) + cap >= WEFT_BUF_LARGE;
+}
+
+static size_t get_large_span(size_t cap)
+{
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	return (sizeof(Weft_Buf) + cap + page_size - 1) & ~(page_size - 1);
+}
+
+static Weft_Buf *map_buf(size_t cap)
+{
+	size_t span = get_large_span(cap);
+	Weft_Buf *buf = mmap(
+		NULL, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buf == MAP_FAILED) {
+		exit(gc_error());
+	}
+
+	buf->cap = span - sizeof(Weft_Buf);
+	return buf;
+}
+
+static Weft_Buf *alloc_buf(size_t cap)
+{
+	Weft_Buf *buf;
+	if (is_large_cap(cap)) {
+		buf = map_buf(cap);
+	} else if ((buf = malloc(sizeof(Weft_Buf) + cap))) {
+		buf->cap = cap;
+	} else {
 		exit(gc_error());
 	}
 
-	buf->cap = cap;
 	buf->at = 0;
+	return buf;
+}
+
+Weft_Buf *new_buf(size_t cap)
+{
+	if (cap < WEFT_BUF_MIN_CAP) {
+		cap = WEFT_BUF_MIN_CAP;
+	}
 
+	Weft_Buf *buf = alloc_buf(cap);
+	buf->min_cap = cap;
+	buf->idle_trims = 0;
 	return buf;
 }
 
+void delete_buf(Weft_Buf *buf)
+{
+	if (is_large_cap(buf->cap)) {
+		munmap(buf, sizeof(Weft_Buf) + buf->cap);
+	} else {
+		free(buf);
+	}
+}
+
 size_t buf_get_cap(const Weft_Buf *buf)
 {
 	return buf->cap;
@@ -48,13 +99,62 @@ void buf_print(const Weft_Buf *buf, size_t size, void *print_fn)
 	}
 }
 
-static size_t realloc_cap(Weft_Buf *buf, size_t requested_size)
+static size_t grow_cap(const Weft_Buf *buf, size_t requested_size)
+{
+	size_t cap = 2 * buf->cap;
+	if (cap < buf->at + requested_size) {
+		cap = buf->at + requested_size;
+	}
+	return cap;
+}
+
+static size_t trim_cap(const Weft_Buf *buf)
+{
+	size_t cap = 2 * buf->at;
+	if (cap < buf->min_cap) {
+		cap = buf->min_cap;
+	}
+	return cap;
+}
+
+static Weft_Buf *remap_buf(Weft_Buf *buf, size_t cap)
+{
+	size_t span = get_large_span(cap);
+	size_t old_span = sizeof(Weft_Buf) + buf->cap;
+	if (span == old_span) {
+		return buf;
+	}
+
+	buf = mremap(buf, old_span, span, MREMAP_MAYMOVE);
+	if (buf == MAP_FAILED) {
+		exit(gc_error());
+	}
+	buf->cap = span - sizeof(Weft_Buf);
+
+	return buf;
+}
+
+static Weft_Buf *move_buf(Weft_Buf *buf, size_t cap)
 {
-	return 2 * (buf->at + requested_size);
+	Weft_Buf *moved = alloc_buf(cap);
+	memcpy(moved->raw, buf->raw, buf->at < cap ? buf->at : cap);
+	moved->at = buf->at;
+	moved->min_cap = buf->min_cap;
+	moved->idle_trims = buf->idle_trims;
+	delete_buf(buf);
+
+	return moved;
 }
 
 static Weft_Buf *realloc_buf(Weft_Buf *buf, size_t cap)
 {
+	bool is_large = is_large_cap(buf->cap);
+	if (is_large && is_large_cap(cap)) {
+		return remap_buf(buf, cap);
+	} else if (is_large || is_large_cap(cap)) {
+		return move_buf(buf, cap);
+	}
+
 	buf = realloc(buf, sizeof(Weft_Buf) + cap);
 	if (!buf) {
 		exit(gc_error());
@@ -66,33 +166,30 @@ static Weft_Buf *realloc_buf(Weft_Buf *buf, size_t cap)
 
 static bool is_shrinkable(const Weft_Buf *buf)
 {
-	return buf->at < buf->cap / 4;
+	return buf->at < buf->cap / 4 && buf->cap > buf->min_cap;
 }
 
-static Weft_Buf *shrink_buf(Weft_Buf *buf)
+void buf_trim(Weft_Buf **buf_p)
 {
-	return realloc_buf(buf, realloc_cap(buf, 0));
-}
-
-static void shrink_if_possible(Weft_Buf **buf_p, Weft_Buf *buf)
-{
-	if (is_shrinkable(buf)) {
-		*buf_p = shrink_buf(buf);
+	Weft_Buf *buf = *buf_p;
+	if (!is_shrinkable(buf)) {
+		buf->idle_trims = 0;
+	} else if (++buf->idle_trims >= WEFT_BUF_SHRINK_DELAY) {
+		buf->idle_trims = 0;
+		*buf_p = realloc_buf(buf, trim_cap(buf));
 	}
 }
 
 void buf_clear(Weft_Buf **buf_p)
 {
-	Weft_Buf *buf = *buf_p;
-	buf->at = 0;
-	shrink_if_possible(buf_p, buf);
+	(*buf_p)->at = 0;
 }
 
 void buf_push(Weft_Buf **buf_p, const void *src, size_t size)
 {
 	Weft_Buf *buf = *buf_p;
 	if (buf->at + size > buf->cap) {
-		buf = realloc_buf(buf, realloc_cap(buf, size));
+		buf = realloc_buf(buf, grow_cap(buf, size));
 		*buf_p = buf;
 	}
 
@@ -102,9 +199,7 @@ void buf_push(Weft_Buf **buf_p, const void *src, size_t size)
 
 void buf_drop(Weft_Buf **buf_p, size_t size)
 {
-	Weft_Buf *buf = *buf_p;
-	buf->at -= size;
-	shrink_if_possible(buf_p, buf);
+	(*buf_p)->at -= size;
 }
 
 void *buf_pop(void *dest, Weft_Buf **buf_p, size_t size)
@@ -112,8 +207,6 @@ void *buf_pop(void *dest, Weft_Buf **buf_p, size_t size)
 	Weft_Buf *buf = *buf_p;
 	buf->at -= size;
 	memcpy(dest, buf->raw + buf->at, size);
-	shrink_if_possible(buf_p, buf);
-
 	return dest;
 }
 
@@ -122,66 +215,148 @@ void *buf_peek(Weft_Buf *buf, size_t size)
 	return buf->raw + buf->at - size;
 }
 
-void buf_push_byte(Weft_Buf **buf_p, uint8_t byte)
+static Weft_BufSegment *new_segment(Weft_BufSegment *prev, size_t cap)
 {
-	Weft_Buf *buf = *buf_p;
-	if (buf->at == buf->cap) {
-		buf = realloc_buf(buf, realloc_cap(buf, 1));
-		*buf_p = buf;
+	Weft_BufSegment *segment = malloc(sizeof(Weft_BufSegment) + cap);
+	if (!segment) {
+		exit(gc_error());
 	}
 
-	buf->raw[buf->at] = byte;
-	buf->at += 1;
+	segment->prev = prev;
+	segment->cap = cap;
+	segment->at = 0;
+	return segment;
 }
 
-uint8_t buf_pop_byte(Weft_Buf **buf_p)
+Weft_SegBuf *new_seg_buf(void)
 {
-	Weft_Buf *buf = *buf_p;
-	buf->at -= 1;
-	uint8_t value = buf->raw[buf->at];
-	shrink_if_possible(buf_p, buf);
+	Weft_SegBuf *buf = malloc(sizeof(Weft_SegBuf));
+	if (!buf) {
+		exit(gc_error());
+	}
 
-	return value;
+	buf->top = new_segment(NULL, WEFT_BUF_MIN_SEGMENT);
+	buf->spare = NULL;
+	buf->at = 0;
+	return buf;
 }
 
-uint8_t buf_peek_byte(Weft_Buf *buf, size_t index)
+void delete_seg_buf(Weft_SegBuf *buf)
 {
-	uint8_t *byte_p = buf_peek(buf, (index + 1) * sizeof(uint8_t));
-	return *byte_p;
+	while (buf->top) {
+		Weft_BufSegment *prev = buf->top->prev;
+		free(buf->top);
+		buf->top = prev;
+	}
+	free(buf->spare);
+	free(buf);
 }
 
-void buf_push_size(Weft_Buf **buf_p, size_t size)
+size_t seg_buf_get_at(const Weft_SegBuf *buf)
 {
-	return buf_push(buf_p, &size, sizeof(size_t));
+	return buf->at;
 }
 
-size_t buf_pop_size(Weft_Buf **buf_p)
+static void retire_segment(Weft_SegBuf *buf)
 {
-	size_t size;
-	buf_pop(&size, buf_p, sizeof(size_t));
-	return size;
+	Weft_BufSegment *top = buf->top;
+	buf->top = top->prev;
+	if (buf->spare && buf->spare->cap > top->cap) {
+		free(top);
+	} else {
+		free(buf->spare);
+		buf->spare = top;
+	}
 }
 
-size_t buf_peek_size(Weft_Buf *buf, size_t index)
+void seg_buf_clear(Weft_SegBuf *buf)
 {
-	size_t *size_p = buf_peek(buf, (index + 1) * sizeof(size_t));
-	return *size_p;
+	while (buf->top->prev) {
+		retire_segment(buf);
+	}
+	buf->top->at = 0;
+	buf->at = 0;
 }
 
-void buf_push_ptr(Weft_Buf **buf_p, void *ptr)
+// The spare segment saves a malloc when a stack hovers at a segment
+// boundary, and is only freed here.
+void seg_buf_trim(Weft_SegBuf *buf)
 {
-	return buf_push(buf_p, &ptr, sizeof(void *));
+	free(buf->spare);
+	buf->spare = NULL;
 }
 
-void *buf_pop_ptr(Weft_Buf **buf_p)
+static void push_segment(Weft_SegBuf *buf, size_t size)
 {
-	void *ptr;
-	buf_pop(&ptr, buf_p, sizeof(void *));
-	return ptr;
+	size_t cap = 2 * buf->top->cap;
+	if (cap > WEFT_BUF_MAX_SEGMENT) {
+		cap = WEFT_BUF_MAX_SEGMENT;
+	}
+	if (cap < size) {
+		cap = size;
+	}
+
+	Weft_BufSegment *spare = buf->spare;
+	if (spare && spare->cap >= size) {
+		buf->spare = NULL;
+		spare->prev = buf->top;
+		spare->at = 0;
+		buf->top = spare;
+	} else {
+		buf->top = new_segment(buf->top, cap);
+	}
+}
+
+void *seg_buf_push(Weft_SegBuf *buf, const void *src, size_t size)
+{
+	if (buf->top->at + size > buf->top->cap) {
+		push_segment(buf, size);
+	}
+
+	Weft_BufSegment *top = buf->top;
+	void *dest = top->raw + top->at;
+	memcpy(dest, src, size);
+	top->at += size;
+	buf->at += size;
+	return dest;
 }
 
-void *buf_peek_ptr(Weft_Buf *buf, size_t index)
+// A drop may span segments, releasing each one it empties.
+void seg_buf_drop(Weft_SegBuf *buf, size_t size)
 {
-	void **ptr_p = buf_peek(buf, (index + 1) * sizeof(void *));
-	return *ptr_p;
+	buf->at -= size;
+	while (size > buf->top->at) {
+		size -= buf->top->at;
+		retire_segment(buf);
+	}
+
+	Weft_BufSegment *top = buf->top;
+	top->at -= size;
+	if (!top->at && top->prev) {
+		retire_segment(buf);
+	}
+}
+
+void *seg_buf_pop(void *dest, Weft_SegBuf *buf, size_t size)
+{
+	memcpy(dest, seg_buf_peek(buf, size), size);
+	seg_buf_drop(buf, size);
+	return dest;
+}
+
+void *seg_buf_peek(Weft_SegBuf *buf, size_t size)
+{
+	return buf->top->raw + buf->top->at - size;
+}
+
+// Values never straddle segments, so indexing assumes every value in the
+// buf has the same size.
+void *seg_buf_peek_at(Weft_SegBuf *buf, size_t size, size_t index)
+{
+	Weft_BufSegment *segment = buf->top;
+	while (index >= segment->at / size) {
+		index -= segment->at / size;
+		segment = segment->prev;
+	}
+	return segment->raw + segment->at - (index + 1) * size;
 }
@@ -1,24 +1,56 @@
 #ifndef WEFT_BUF_H
 #define WEFT_BUF_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 // Forward Declarations
 
 typedef struct weft_buf Weft_Buf;
+typedef struct weft_buf_segment Weft_BufSegment;
+typedef struct weft_seg_buf Weft_SegBuf;
+
+// Constants
+
+static const size_t WEFT_BUF_LARGE = 1 << 18;
+static const size_t WEFT_BUF_MIN_CAP = 64;
+static const size_t WEFT_BUF_SHRINK_DELAY = 2;
+static const size_t WEFT_BUF_MIN_SEGMENT = 1 << 10;
+static const size_t WEFT_BUF_MAX_SEGMENT = 1 << 20;
 
 // Data Types
 
+// A buf only shrinks in buf_trim, and only once it has been under a
+// quarter full for WEFT_BUF_SHRINK_DELAY trims in a row.
 struct weft_buf {
+	size_t cap;
+	size_t at;
+	size_t min_cap;
+	size_t idle_trims;
+	char raw[];
+};
+
+// A segmented buf grows by chaining segments, so the address of a pushed
+// value stays valid until it is popped.
+struct weft_buf_segment {
+	Weft_BufSegment *prev;
 	size_t cap;
 	size_t at;
 	char raw[];
 };
 
+struct weft_seg_buf {
+	Weft_BufSegment *top;
+	Weft_BufSegment *spare;
+	size_t at;
+};
+
 // Functions
 
 Weft_Buf *new_buf(size_t cap);
+void delete_buf(Weft_Buf *buf);
 size_t buf_get_cap(const Weft_Buf *buf);
 size_t buf_get_at(const Weft_Buf *buf);
 void *buf_get_raw(Weft_Buf *buf);
@@ -29,14 +61,134 @@ void buf_drop(Weft_Buf **buf_p, size_t size);
 void *buf_pop(void *dest, Weft_Buf **buf_p, size_t size);
 void *buf_peek(Weft_Buf *buf, size_t size);
 
-void buf_push_byte(Weft_Buf **buf_p, uint8_t byte);
-uint8_t buf_pop_byte(Weft_Buf **buf_p);
-uint8_t buf_peek_byte(Weft_Buf *buf, size_t index);
-void buf_push_size(Weft_Buf **buf_p, size_t size);
-size_t buf_pop_size(Weft_Buf **buf_p);
-size_t buf_peek_size(Weft_Buf *buf, size_t index);
-void buf_push_ptr(Weft_Buf **buf_p, void *ptr);
-void *buf_pop_ptr(Weft_Buf **buf_p);
-void *buf_peek_ptr(Weft_Buf *buf, size_t index);
+void buf_trim(Weft_Buf **buf_p);
+
+Weft_SegBuf *new_seg_buf(void);
+void delete_seg_buf(Weft_SegBuf *buf);
+size_t seg_buf_get_at(const Weft_SegBuf *buf);
+void seg_buf_clear(Weft_SegBuf *buf);
+void seg_buf_trim(Weft_SegBuf *buf);
+void *seg_buf_push(Weft_SegBuf *buf, const void *src, size_t size);
+void seg_buf_drop(Weft_SegBuf *buf, size_t size);
+void *seg_buf_pop(void *dest, Weft_SegBuf *buf, size_t size);
+void *seg_buf_peek(Weft_SegBuf *buf, size_t size);
+void *seg_buf_peek_at(Weft_SegBuf *buf, size_t size, size_t index);
+
+static inline void buf_push_byte(Weft_Buf **buf_p, uint8_t byte)
+{
+	Weft_Buf *buf = *buf_p;
+	if (buf->at == buf->cap) {
+		buf_push(buf_p, &byte, sizeof(uint8_t));
+		return;
+	}
+
+	buf->raw[buf->at] = byte;
+	buf->at += 1;
+}
+
+static inline uint8_t buf_pop_byte(Weft_Buf **buf_p)
+{
+	Weft_Buf *buf = *buf_p;
+	buf->at -= 1;
+	return buf->raw[buf->at];
+}
+
+static inline uint8_t buf_peek_byte(Weft_Buf *buf, size_t index)
+{
+	return buf->raw[buf->at - index - 1];
+}
+
+static inline void buf_push_size(Weft_Buf **buf_p, size_t size)
+{
+	Weft_Buf *buf = *buf_p;
+	if (buf->at + sizeof(size_t) > buf->cap) {
+		buf_push(buf_p, &size, sizeof(size_t));
+		return;
+	}
+
+	memcpy(buf->raw + buf->at, &size, sizeof(size_t));
+	buf->at += sizeof(size_t);
+}
+
+static inline size_t buf_pop_size(Weft_Buf **buf_p)
+{
+	Weft_Buf *buf = *buf_p;
+	size_t size;
+	buf->at -= sizeof(size_t);
+	memcpy(&size, buf->raw + buf->at, sizeof(size_t));
+	return size;
+}
+
+static inline size_t buf_peek_size(Weft_Buf *buf, size_t index)
+{
+	size_t size;
+	memcpy(&size, buf->raw + buf->at - (index + 1) * sizeof(size_t),
+	       sizeof(size_t));
+	return size;
+}
+
+static inline void buf_push_ptr(Weft_Buf **buf_p, void *ptr)
+{
+	Weft_Buf *buf = *buf_p;
+	if (buf->at + sizeof(void *) > buf->cap) {
+		buf_push(buf_p, &ptr, sizeof(void *));
+		return;
+	}
+
+	memcpy(buf->raw + buf->at, &ptr, sizeof(void *));
+	buf->at += sizeof(void *);
+}
+
+static inline void *buf_pop_ptr(Weft_Buf **buf_p)
+{
+	Weft_Buf *buf = *buf_p;
+	void *ptr;
+	buf->at -= sizeof(void *);
+	memcpy(&ptr, buf->raw + buf->at, sizeof(void *));
+	return ptr;
+}
+
+static inline void *buf_peek_ptr(Weft_Buf *buf, size_t index)
+{
+	void *ptr;
+	memcpy(&ptr, buf->raw + buf->at - (index + 1) * sizeof(void *),
+	       sizeof(void *));
+	return ptr;
+}
+
+static inline void *seg_buf_push_ptr(Weft_SegBuf *buf, void *ptr)
+{
+	Weft_BufSegment *top = buf->top;
+	if (top->at + sizeof(void *) > top->cap) {
+		return seg_buf_push(buf, &ptr, sizeof(void *));
+	}
+
+	void *slot = top->raw + top->at;
+	memcpy(slot, &ptr, sizeof(void *));
+	top->at += sizeof(void *);
+	buf->at += sizeof(void *);
+	return slot;
+}
+
+static inline void *seg_buf_pop_ptr(Weft_SegBuf *buf)
+{
+	void *ptr;
+	Weft_BufSegment *top = buf->top;
+	if (top->at < 2 * sizeof(void *)) {
+		return *(void **)seg_buf_pop(&ptr, buf, sizeof(void *));
+	}
+
+	top->at -= sizeof(void *);
+	buf->at -= sizeof(void *);
+	memcpy(&ptr, top->raw + top->at, sizeof(void *));
+	return ptr;
+}
+
+static inline void *seg_buf_peek_ptr(Weft_SegBuf *buf, size_t index)
+{
+	void *ptr;
+	memcpy(&ptr, seg_buf_peek_at(buf, sizeof(void *), index), sizeof(void *));
+	return ptr;
+}
 
 #endif
@@ -1,13 +1,82 @@
 #include "gc.h"
+#include "buf.h"
+#include "mark.h"
+#include "slab.h"
 
+#include <ctype.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Forward Declarations
+
+typedef struct weft_gc_thread Weft_GCThread;
+
+// Data Types
+
+struct weft_gc_thread {
+	Weft_Slab *tlab[WEFT_SLAB_TYPE_COUNT][WEFT_SLAB_CLASS_COUNT];
+	Weft_SegBuf *shadow;
+};
 
 // Globals
 
-static Weft_GC *g_heap;
-size_t g_trigger = WEFT_GC_INIT_TRIGGER;
-size_t g_count = 0;
+size_t g_live_bytes = 0;
+size_t g_trigger = WEFT_GC_MIN_HEAP;
+double g_growth = WEFT_GC_GROWTH;
+size_t g_min_heap = WEFT_GC_MIN_HEAP;
+size_t g_max_heap = WEFT_GC_MAX_HEAP;
+size_t g_nursery = WEFT_GC_NURSERY;
+size_t g_young_bytes = 0;
+bool g_is_major_next = true;
+bool g_is_major = true;
+_Atomic(Weft_GCPhase) g_phase = WEFT_GC_IDLE;
+bool g_is_incremental = false;
+size_t g_step = WEFT_GC_STEP;
+double g_max_pause = WEFT_GC_MAX_PAUSE;
+size_t g_debt = 0;
+size_t g_marked_count = 0;
+size_t g_marked_bytes = 0;
+size_t g_live_count = 0;
+double g_cycle_mark_time = 0.0;
+double g_start_time = 0.0;
+Weft_GCStats g_stats;
+FILE *g_trace_file = NULL;
+bool g_is_lazy_sweep = true;
+bool g_is_background_sweep = false;
+bool g_is_compacting = false;
+double g_compact_threshold = WEFT_GC_COMPACT_THRESHOLD;
+bool g_has_sweeper = false;
+bool g_is_sweeper_stopping = false;
+pthread_t g_sweeper;
+pthread_mutex_t g_heap_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t g_sweep_cond = PTHREAD_COND_INITIALIZER;
+pthread_once_t g_configure_once = PTHREAD_ONCE_INIT;
+Weft_GCOomFn g_oom_fn = NULL;
+Weft_GCTraceFn g_trace[WEFT_SLAB_TYPE_COUNT];
+size_t g_type_count = 1;
+Weft_Buf *g_remembered;
+Weft_Buf *g_gray;
+Weft_Buf *g_roots;
+Weft_Buf *g_weak;
+Weft_Buf *g_threads;
+atomic_bool g_is_threaded = false;
+bool g_is_world_stopped = false;
+atomic_bool g_is_safepoint_requested = false;
+size_t g_parked_count = 0;
+pthread_mutex_t g_world_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t g_park_cond = PTHREAD_COND_INITIALIZER;
+pthread_cond_t g_resume_cond = PTHREAD_COND_INITIALIZER;
+_Thread_local Weft_GCThread *t_thread;
+_Thread_local bool t_is_configuring = false;
+_Thread_local bool t_has_stopped_world = false;
+_Thread_local double t_sweep_time = 0.0;
+void *g_prefetch[WEFT_GC_PREFETCH_DEPTH];
+size_t g_prefetch_head = 0;
+size_t g_prefetch_count = 0;
 
 // Functions
 
@@ -17,100 +86,1167 @@ int gc_error(void)
 	return 1;
 }
 
-static Weft_GC *get_tag(void *ptr)
+static size_t parse_env_size(const char *value)
 {
-	return (Weft_GC *)ptr - 1;
+	char *end;
+	size_t size = strtoull(value, &end, 10);
+	switch (tolower(*end)) {
+	case 'g':
+		size <<= 10;
+		// fallthrough
+	case 'm':
+		size <<= 10;
+		// fallthrough
+	case 'k':
+		size <<= 10;
+	default:
+		break;
+	}
+	return size;
 }
 
-static Weft_GC *get_tag_prev(Weft_GC *tag)
+static void open_trace(const char *path)
 {
-	return (Weft_GC *)(tag->prev >> 1);
+	if (!strcmp(path, "1") || !strcmp(path, "stderr")) {
+		g_trace_file = stderr;
+	} else if (!(g_trace_file = fopen(path, "a"))) {
+		perror("Could not open GC trace file");
+	}
 }
 
-static void set_tag_prev(Weft_GC *tag, Weft_GC *prev)
+static double get_time(void)
 {
-	tag->prev = (uintptr_t)prev << 1;
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
 }
 
-static bool is_tag_marked(const Weft_GC *tag)
+static Weft_GCThread *new_thread(void)
 {
-	return tag->prev & 1;
+	Weft_GCThread *thread = calloc(1, sizeof(Weft_GCThread));
+	if (!thread) {
+		exit(gc_error());
+	}
+
+	thread->shadow = new_seg_buf();
+	return thread;
 }
 
-static void mark_tag(Weft_GC *tag)
+static void configure(void)
 {
-	tag->prev |= 1;
+	const char *value;
+	t_is_configuring = true;
+	g_start_time = get_time();
+	g_remembered = new_buf(sizeof(void *));
+	g_gray = new_buf(sizeof(void *));
+	g_roots = new_buf(sizeof(void *));
+	g_weak = new_buf(sizeof(Weft_GCWeakFn));
+	g_threads = new_buf(sizeof(void *));
+	t_thread = new_thread();
+	buf_push_ptr(&g_threads, t_thread);
+	if ((value = getenv("WEFT_GC_GROWTH"))) {
+		gc_set_growth(strtod(value, NULL));
+	}
+	if ((value = getenv("WEFT_GC_MIN_HEAP"))) {
+		gc_set_min_heap(parse_env_size(value));
+	}
+	if ((value = getenv("WEFT_GC_MAX_HEAP"))) {
+		gc_set_max_heap(parse_env_size(value));
+	}
+	if ((value = getenv("WEFT_GC_NURSERY"))) {
+		gc_set_nursery(parse_env_size(value));
+	}
+	if ((value = getenv("WEFT_GC_INCREMENTAL"))) {
+		gc_set_incremental(atoi(value));
+	}
+	if ((value = getenv("WEFT_GC_STEP"))) {
+		gc_set_step(parse_env_size(value));
+	}
+	if ((value = getenv("WEFT_GC_MAX_PAUSE_US"))) {
+		gc_set_max_pause(strtod(value, NULL) / 1e6);
+	}
+	if ((value = getenv("WEFT_GC_LAZY_SWEEP"))) {
+		gc_set_lazy_sweep(atoi(value));
+	}
+	if ((value = getenv("WEFT_GC_SWEEP_THREAD"))) {
+		gc_set_background_sweep(atoi(value));
+	}
+	if ((value = getenv("WEFT_GC_COMPACT"))) {
+		gc_set_compaction(atoi(value));
+	}
+	if ((value = getenv("WEFT_GC_COMPACT_THRESHOLD"))) {
+		gc_set_compact_threshold(strtod(value, NULL));
+	}
+	if ((value = getenv("WEFT_GC_MARK_THREADS"))) {
+		gc_set_mark_threads(atoi(value));
+	}
+	if ((value = getenv("WEFT_GC_TRACE"))) {
+		open_trace(value);
+	}
+	t_is_configuring = false;
 }
 
-static void unmark_tag(Weft_GC *tag)
+static void out_of_memory(size_t size)
 {
-	tag->prev &= ~(uintptr_t)1;
+	if (g_oom_fn) {
+		g_oom_fn(size);
+	}
+	fprintf(stderr,
+	        "Heap limit of %zu bytes exceeded allocating %zu bytes\n",
+	        g_max_heap,
+	        size);
+	exit(1);
 }
 
-void *gc_alloc(size_t size)
+static void configure_once(void)
 {
-	Weft_GC *tag = malloc(sizeof(Weft_GC) + size);
-	if (!tag) {
-		exit(gc_error());
+	if (!t_is_configuring) {
+		pthread_once(&g_configure_once, configure);
+	}
+}
+
+static void lock_heap(void)
+{
+	if (g_has_sweeper || g_is_threaded) {
+		pthread_mutex_lock(&g_heap_lock);
 	}
+}
 
-	set_tag_prev(tag, g_heap);
-	g_heap = tag;
-	g_count++;
+static void unlock_heap(void)
+{
+	if (g_has_sweeper || g_is_threaded) {
+		pthread_mutex_unlock(&g_heap_lock);
+	}
+}
 
-	return tag->ptr;
+static void set_trigger(size_t live_bytes)
+{
+	double trigger = g_growth * (double)live_bytes;
+	if (trigger < (double)g_min_heap) {
+		trigger = (double)g_min_heap;
+	}
+
+	if (g_max_heap && trigger > (double)g_max_heap) {
+		trigger = (double)g_max_heap;
+	}
+	g_trigger = (size_t)trigger;
 }
 
-bool gc_mark(void *ptr)
+static bool mark(void *ptr);
+
+static void mark_slot(void *slot)
+{
+	mark(*(void **)slot);
+}
+
+static void trace(void *ptr)
+{
+	Weft_GCTraceFn trace_fn = g_trace[slab_get_type(ptr)];
+	if (trace_fn) {
+		trace_fn(ptr, mark_slot);
+	}
+}
+
+static void mark_root_buf(Weft_Buf *buf)
+{
+	void **slots = buf_get_raw(buf);
+	size_t count = buf_get_at(buf) / sizeof(void *);
+	for (size_t i = 0; i < count; i++) {
+		mark_slot(slots[i]);
+	}
+}
+
+static void visit_shadow(Weft_SegBuf *shadow, Weft_GCVisitFn visit)
+{
+	Weft_BufSegment *segment = shadow->top;
+	for (; segment; segment = segment->prev) {
+		void **slots = (void **)segment->raw;
+		size_t count = segment->at / sizeof(void *);
+		for (size_t i = 0; i < count; i++) {
+			visit(slots[i]);
+		}
+	}
+}
+
+static void mark_roots(void)
+{
+	mark_root_buf(g_roots);
+
+	Weft_GCThread **threads = buf_get_raw(g_threads);
+	size_t count = buf_get_at(g_threads) / sizeof(void *);
+	for (size_t i = 0; i < count; i++) {
+		visit_shadow(threads[i]->shadow, mark_slot);
+	}
+}
+
+static bool is_over_trigger(void)
+{
+	lock_heap();
+	bool is_over = (g_nursery && g_young_bytes >= g_nursery)
+	            || slab_get_used_bytes() >= g_trigger;
+	unlock_heap();
+
+	return is_over;
+}
+
+static size_t get_pause_bucket(double pause)
+{
+	size_t us = pause * 1e6;
+	if (!us) {
+		return 0;
+	}
+
+	size_t bucket = 8 * sizeof(unsigned long) - __builtin_clzl(us);
+	if (bucket >= WEFT_GC_PAUSE_BUCKETS) {
+		return WEFT_GC_PAUSE_BUCKETS - 1;
+	}
+	return bucket;
+}
+
+static double record_pause(double start, double sweep_time)
+{
+	double pause = get_time() - start;
+	double mark_time = pause - (t_sweep_time - sweep_time);
+
+	lock_heap();
+	g_stats.mark_time += mark_time;
+	g_cycle_mark_time += mark_time;
+	g_stats.pause_time += pause;
+	g_stats.pause_count++;
+	g_stats.pause_histogram[get_pause_bucket(pause)]++;
+	if (pause > g_stats.longest_pause) {
+		g_stats.longest_pause = pause;
+	}
+	unlock_heap();
+
+	return pause;
+}
+
+static bool is_over_budget(size_t work, size_t count, double start)
+{
+	const size_t CLOCK_INTERVAL = 64;
+	if (work >= g_step) {
+		return true;
+	} else if (count % CLOCK_INTERVAL) {
+		return false;
+	}
+	return get_time() - start >= g_max_pause;
+}
+
+static void fill_prefetch(void)
+{
+	while (g_prefetch_count < WEFT_GC_PREFETCH_DEPTH && buf_get_at(g_gray)) {
+		void *ptr = buf_pop_ptr(&g_gray);
+		__builtin_prefetch(ptr);
+
+		size_t tail =
+			(g_prefetch_head + g_prefetch_count) % WEFT_GC_PREFETCH_DEPTH;
+		g_prefetch[tail] = ptr;
+		g_prefetch_count++;
+	}
+}
+
+static void *pop_prefetch(void)
+{
+	void *ptr = g_prefetch[g_prefetch_head];
+	g_prefetch_head = (g_prefetch_head + 1) % WEFT_GC_PREFETCH_DEPTH;
+	g_prefetch_count--;
+
+	return ptr;
+}
+
+static bool is_gray_empty(void)
+{
+	return !g_prefetch_count && !buf_get_at(g_gray);
+}
+
+static bool drain_gray(bool is_bounded, double start)
+{
+	size_t work = 0;
+	size_t count = 0;
+	while (true) {
+		fill_prefetch();
+		if (!g_prefetch_count) {
+			return true;
+		}
+
+		void *ptr = pop_prefetch();
+		trace(ptr);
+		work += slab_get_size(ptr);
+		count++;
+
+		if (is_bounded && is_over_budget(work, count, start)) {
+			return is_gray_empty();
+		}
+	}
+}
+
+static void drain_all(double start)
+{
+	if (mark_get_threads() < 2) {
+		drain_gray(false, start);
+		return;
+	}
+
+	while (g_prefetch_count) {
+		buf_push_ptr(&g_gray, pop_prefetch());
+	}
+	size_t count = buf_get_at(g_gray) / sizeof(void *);
+	mark_drain(buf_get_raw(g_gray),
+	           count,
+	           g_trace,
+	           &g_marked_count,
+	           &g_marked_bytes);
+	buf_drop(&g_gray, count * sizeof(void *));
+}
+
+static void begin_mark(void)
+{
+	g_is_major = g_is_major_next;
+	g_cycle_mark_time = 0.0;
+	while (buf_get_at(g_remembered)) {
+		void *obj = buf_pop_ptr(&g_remembered);
+		slab_forget(obj);
+		if (!g_is_major) {
+			trace(obj);
+		}
+	}
+	mark_roots();
+	g_phase = WEFT_GC_MARK;
+}
+
+static void *run_sweeper(void *arg)
+{
+	const size_t SWEEP_BATCH = 16;
+	(void)arg;
+
+	pthread_mutex_lock(&g_heap_lock);
+	while (!g_is_sweeper_stopping) {
+		if (!slab_is_sweeping()) {
+			pthread_cond_wait(&g_sweep_cond, &g_heap_lock);
+			continue;
+		}
+
+		for (size_t i = 0; i < SWEEP_BATCH && slab_sweep_next(); i++) {
+		}
+		pthread_mutex_unlock(&g_heap_lock);
+		sched_yield();
+		pthread_mutex_lock(&g_heap_lock);
+	}
+	pthread_mutex_unlock(&g_heap_lock);
+
+	return NULL;
+}
+
+static void start_sweeper(void)
+{
+	g_is_sweeper_stopping = false;
+	if (pthread_create(&g_sweeper, NULL, run_sweeper, NULL)) {
+		perror("Could not start sweeper thread");
+		return;
+	}
+	g_has_sweeper = true;
+}
+
+static void stop_sweeper(void)
+{
+	pthread_mutex_lock(&g_heap_lock);
+	g_is_sweeper_stopping = true;
+	pthread_cond_signal(&g_sweep_cond);
+	pthread_mutex_unlock(&g_heap_lock);
+
+	pthread_join(g_sweeper, NULL);
+	g_has_sweeper = false;
+}
+
+static size_t get_other_thread_count(void)
+{
+	size_t count = buf_get_at(g_threads) / sizeof(void *);
+	return t_thread ? count - 1 : count;
+}
+
+static void park(void)
+{
+	if (!t_thread) {
+		pthread_cond_wait(&g_resume_cond, &g_world_lock);
+		return;
+	}
+
+	g_parked_count++;
+	pthread_cond_broadcast(&g_park_cond);
+	while (g_is_world_stopped) {
+		pthread_cond_wait(&g_resume_cond, &g_world_lock);
+	}
+	g_parked_count--;
+}
+
+static void stop_world(void)
+{
+	if (!g_is_threaded && t_thread) {
+		return;
+	}
+
+	pthread_mutex_lock(&g_world_lock);
+	while (g_is_world_stopped) {
+		park();
+	}
+	g_is_world_stopped = true;
+	atomic_store(&g_is_safepoint_requested, true);
+
+	while (g_parked_count < get_other_thread_count()) {
+		pthread_cond_wait(&g_park_cond, &g_world_lock);
+	}
+	pthread_mutex_unlock(&g_world_lock);
+	t_has_stopped_world = true;
+}
+
+static void start_world(void)
+{
+	if (!t_has_stopped_world) {
+		return;
+	}
+	t_has_stopped_world = false;
+
+	pthread_mutex_lock(&g_world_lock);
+	g_is_world_stopped = false;
+	atomic_store(&g_is_safepoint_requested, false);
+	pthread_cond_broadcast(&g_resume_cond);
+	pthread_mutex_unlock(&g_world_lock);
+}
+
+static size_t return_tlab(Weft_Slab *slab)
+{
+	size_t count = slab_return(slab);
+	size_t bytes = count * slab->cell_size;
+	g_young_bytes += bytes;
+	g_stats.allocated_count += count;
+	g_stats.allocated_bytes += bytes;
+
+	return bytes;
+}
+
+static void flush_tlabs(Weft_GCThread *thread)
+{
+	for (size_t type = 0; type < g_type_count; type++) {
+		for (size_t class = 0; class < WEFT_SLAB_CLASS_COUNT; class++) {
+			Weft_Slab **tlab_p = &thread->tlab[type][class];
+			if (*tlab_p) {
+				return_tlab(*tlab_p);
+				*tlab_p = NULL;
+			}
+		}
+	}
+}
+
+static void flush_all_tlabs(void)
+{
+	Weft_GCThread **threads = buf_get_raw(g_threads);
+	size_t count = buf_get_at(g_threads) / sizeof(void *);
+
+	lock_heap();
+	for (size_t i = 0; i < count; i++) {
+		flush_tlabs(threads[i]);
+	}
+	unlock_heap();
+}
+
+static void end_mark(void)
+{
+	g_stats.collections++;
+	if (g_is_major) {
+		g_stats.major_collections++;
+		g_live_count = g_marked_count;
+		g_live_bytes = g_marked_bytes;
+		set_trigger(g_live_bytes);
+	} else {
+		g_live_count += g_marked_count;
+		g_live_bytes += g_marked_bytes;
+	}
+
+	// Roots the caller marks before the next collection count toward it,
+	// so the counters are cleared here rather than in begin_mark.
+	g_marked_count = 0;
+	g_marked_bytes = 0;
+	g_is_major_next = !g_nursery || g_live_bytes + g_nursery >= g_trigger;
+}
+
+static void visit_weak(Weft_GCVisitFn visit)
+{
+	Weft_GCWeakFn *weak = buf_get_raw(g_weak);
+	size_t count = buf_get_at(g_weak) / sizeof(Weft_GCWeakFn);
+	for (size_t i = 0; i < count; i++) {
+		weak[i](visit);
+	}
+}
+
+static void clear_slot(void *slot)
+{
+	void **ptr_p = slot;
+	if (*ptr_p && !slab_is_marked(*ptr_p)) {
+		*ptr_p = NULL;
+	}
+}
+
+static void fix_slot(void *slot)
+{
+	void **ptr_p = slot;
+	if (*ptr_p && slab_is_evacuated(*ptr_p)) {
+		*ptr_p = slab_get_forward(*ptr_p);
+	}
+}
+
+static void fix_object(void *ptr)
+{
+	g_trace[slab_get_type(ptr)](ptr, fix_slot);
+}
+
+static void fix_root_buf(Weft_Buf *buf)
+{
+	void **slots = buf_get_raw(buf);
+	size_t count = buf_get_at(buf) / sizeof(void *);
+	for (size_t i = 0; i < count; i++) {
+		fix_slot(slots[i]);
+	}
+}
+
+// Moves the survivors out of sparse slabs once the whole heap is marked,
+// so every reference can be found through the roots and trace callbacks.
+static void compact(void)
+{
+	lock_heap();
+	if (slab_get_fragmentation() < g_compact_threshold
+	    || !slab_evacuate(WEFT_GC_COMPACT_OCCUPANCY)) {
+		unlock_heap();
+		return;
+	}
+
+	for (size_t type = 0; type < g_type_count; type++) {
+		if (g_trace[type]) {
+			slab_visit_marked(type, fix_object);
+		}
+	}
+
+	fix_root_buf(g_roots);
+	visit_weak(fix_slot);
+	Weft_GCThread **threads = buf_get_raw(g_threads);
+	size_t count = buf_get_at(g_threads) / sizeof(void *);
+	for (size_t i = 0; i < count; i++) {
+		visit_shadow(threads[i]->shadow, fix_slot);
+	}
+
+	slab_end_evacuate();
+	g_stats.compactions++;
+	unlock_heap();
+}
+
+static void begin_sweep(void)
+{
+	end_mark();
+
+	bool keep_marks = g_nursery && !g_is_major_next;
+	lock_heap();
+	slab_end_pins();
+	slab_begin_sweep(g_is_major || !keep_marks, keep_marks);
+	if (g_has_sweeper) {
+		pthread_cond_signal(&g_sweep_cond);
+	}
+	unlock_heap();
+
+	g_young_bytes = 0;
+	g_phase = WEFT_GC_SWEEP;
+}
+
+static void trim_bufs(void)
+{
+	buf_trim(&g_gray);
+	buf_trim(&g_remembered);
+
+	Weft_GCThread **threads = buf_get_raw(g_threads);
+	size_t count = buf_get_at(g_threads) / sizeof(void *);
+	for (size_t i = 0; i < count; i++) {
+		seg_buf_trim(threads[i]->shadow);
+	}
+}
+
+static bool sweep_slabs(bool is_bounded, double start)
+{
+	const size_t SLAB_SWEEP_COST = WEFT_SLAB_SIZE / 16;
+	size_t work = 0;
+	size_t count = 0;
+	double sweep_start = get_time();
+
+	lock_heap();
+	while (slab_sweep_next()) {
+		work += SLAB_SWEEP_COST;
+		count++;
+
+		if (is_bounded && is_over_budget(work, count, start)) {
+			break;
+		}
+	}
+	bool is_done = !slab_is_sweeping();
+	double sweep_time = get_time() - sweep_start;
+	g_stats.sweep_time += sweep_time;
+	unlock_heap();
+
+	t_sweep_time += sweep_time;
+	return is_done;
+}
+
+static void finish_sweep(void)
+{
+	sweep_slabs(false, 0.0);
+	g_phase = WEFT_GC_IDLE;
+}
+
+static bool is_stepping(void)
+{
+	return g_phase == WEFT_GC_MARK || g_phase == WEFT_GC_SWEEP;
+}
+
+static void step(void)
+{
+	double start = get_time();
+	double sweep_time = t_sweep_time;
+	if (g_phase == WEFT_GC_MARK) {
+		stop_world();
+		if (g_phase == WEFT_GC_MARK && drain_gray(true, start)) {
+			g_phase = WEFT_GC_REMARK;
+		}
+		start_world();
+	} else if (g_phase == WEFT_GC_SWEEP && sweep_slabs(true, start)) {
+		g_phase = WEFT_GC_IDLE;
+	}
+	record_pause(start, sweep_time);
+}
+
+static bool pay_debt(size_t bytes)
+{
+	g_debt += bytes;
+	if (g_debt < g_step / 2) {
+		return false;
+	}
+	g_debt = 0;
+
+	return true;
+}
+
+Weft_GCType gc_new_type(Weft_GCTraceFn trace)
+{
+	if (g_type_count == WEFT_SLAB_TYPE_COUNT) {
+		fprintf(stderr, "Too many GC types registered\n");
+		exit(1);
+	}
+
+	g_trace[g_type_count] = trace;
+	return g_type_count++;
+}
+
+// Finalizers run while the heap is being swept, possibly on the sweeper
+// thread, so they must not touch the GC heap.
+void gc_set_finalizer(Weft_GCType type, Weft_GCFinalizeFn finalize)
+{
+	lock_heap();
+	slab_set_finalizer(type, finalize);
+	unlock_heap();
+}
+
+static Weft_GCThread *get_thread(void)
+{
+	if (!t_thread) {
+		configure_once();
+		if (!t_thread) {
+			fprintf(stderr, "GC used from an unregistered thread\n");
+			exit(1);
+		}
+	}
+	return t_thread;
+}
+
+static void *alloc_slow(Weft_GCThread *thread, size_t size, Weft_GCType type)
+{
+	Weft_Slab **tlab_p = NULL;
+	if (size <= WEFT_SLAB_MAX_CELL) {
+		tlab_p = &thread->tlab[type][slab_get_class(size)];
+	}
+
+	if (tlab_p && *tlab_p) {
+		lock_heap();
+		size_t bytes = return_tlab(*tlab_p);
+		*tlab_p = NULL;
+		bool is_step_due = g_is_incremental && is_stepping() && pay_debt(bytes);
+		unlock_heap();
+
+		if (is_step_due) {
+			step();
+		}
+	}
+
+	void *ptr;
+	lock_heap();
+	if (g_max_heap && slab_get_used_bytes() + size > g_max_heap) {
+		unlock_heap();
+		out_of_memory(size);
+	}
+
+	if (tlab_p) {
+		if (!(*tlab_p = slab_acquire(size, type))) {
+			exit(gc_error());
+		}
+		ptr = slab_alloc_owned(*tlab_p);
+	} else {
+		if (!(ptr = slab_alloc(size, type))) {
+			exit(gc_error());
+		}
+		size_t bytes = slab_get_size(ptr);
+		g_young_bytes += bytes;
+		g_stats.allocated_count++;
+		g_stats.allocated_bytes += bytes;
+		if (g_is_incremental && is_stepping()) {
+			g_debt += bytes;
+		}
+	}
+	unlock_heap();
+
+	return ptr;
+}
+
+void *gc_alloc_typed(size_t size, Weft_GCType type)
+{
+	Weft_GCThread *thread = get_thread();
+	if (atomic_load_explicit(&g_is_safepoint_requested, memory_order_relaxed)) {
+		gc_safepoint();
+	}
+
+	if (size <= WEFT_SLAB_MAX_CELL) {
+		Weft_Slab *slab = thread->tlab[type][slab_get_class(size)];
+		void *ptr;
+		if (slab && (ptr = slab_alloc_owned(slab))) {
+			return ptr;
+		}
+	}
+	return alloc_slow(thread, size, type);
+}
+
+void *gc_alloc(size_t size)
+{
+	return gc_alloc_typed(size, WEFT_GC_LEAF);
+}
+
+static bool mark(void *ptr)
 {
 	if (!ptr) {
 		return true;
+	} else if (g_phase == WEFT_GC_SWEEP) {
+		finish_sweep();
 	}
 
-	Weft_GC *tag = get_tag(ptr);
-	if (is_tag_marked(tag)) {
+	if (slab_mark(ptr)) {
 		return true;
 	}
-	mark_tag(tag);
 
+	g_marked_count++;
+	g_marked_bytes += slab_get_size(ptr);
+	if (g_trace[slab_get_type(ptr)]) {
+		buf_push_ptr(&g_gray, ptr);
+	}
 	return false;
 }
 
+// The caller may hold ptr outside any registered slot, so it is pinned
+// for the rest of the cycle rather than moved by compaction.
+bool gc_mark(void *ptr)
+{
+	if (ptr) {
+		slab_pin(ptr);
+	}
+	return mark(ptr);
+}
+
+static bool is_marking(void)
+{
+	return g_phase == WEFT_GC_MARK || g_phase == WEFT_GC_REMARK;
+}
+
+void gc_write_barrier(void *obj, void *value)
+{
+	if (!value) {
+		return;
+	} else if (is_marking()) {
+		lock_heap();
+		mark(value);
+		unlock_heap();
+		return;
+	}
+
+	if (!g_nursery) {
+		return;
+	}
+
+	lock_heap();
+	bool is_remembered = !slab_is_marked(obj) || slab_is_marked(value)
+	                  || slab_remember(obj);
+	if (!is_remembered) {
+		buf_push_ptr(&g_remembered, obj);
+	}
+	unlock_heap();
+}
+
+void gc_add_root(void *slot)
+{
+	configure_once();
+	buf_push_ptr(&g_roots, slot);
+}
+
+void gc_remove_root(void *slot)
+{
+	void **slots = buf_get_raw(g_roots);
+	size_t count = buf_get_at(g_roots) / sizeof(void *);
+	for (size_t i = 0; i < count; i++) {
+		if (slots[i] == slot) {
+			slots[i] = slots[count - 1];
+			buf_drop(&g_roots, sizeof(void *));
+			return;
+		}
+	}
+}
+
+// Weak slots are visited once marking is done. Slots holding unmarked
+// objects are cleared, and the rest are fixed up if compaction moves them.
+void gc_add_weak(Weft_GCWeakFn weak)
+{
+	configure_once();
+	buf_push(&g_weak, &weak, sizeof(Weft_GCWeakFn));
+}
+
+void gc_push_root(void *slot)
+{
+	seg_buf_push_ptr(get_thread()->shadow, slot);
+}
+
+void gc_pop_roots(size_t count)
+{
+	seg_buf_drop(get_thread()->shadow, count * sizeof(void *));
+}
+
+void gc_register_thread(void)
+{
+	configure_once();
+	if (t_thread) {
+		return;
+	}
+
+	Weft_GCThread *thread = new_thread();
+	stop_world();
+	pthread_mutex_lock(&g_world_lock);
+	buf_push_ptr(&g_threads, thread);
+	pthread_mutex_unlock(&g_world_lock);
+	g_is_threaded = true;
+	start_world();
+	t_thread = thread;
+}
+
+void gc_unregister_thread(void)
+{
+	Weft_GCThread *thread = t_thread;
+	if (!thread) {
+		return;
+	}
+
+	lock_heap();
+	flush_tlabs(thread);
+	unlock_heap();
+
+	stop_world();
+	pthread_mutex_lock(&g_world_lock);
+	Weft_GCThread **threads = buf_get_raw(g_threads);
+	size_t count = buf_get_at(g_threads) / sizeof(void *);
+	for (size_t i = 0; i < count; i++) {
+		if (threads[i] == thread) {
+			threads[i] = threads[count - 1];
+			buf_drop(&g_threads, sizeof(void *));
+			break;
+		}
+	}
+	pthread_mutex_unlock(&g_world_lock);
+	t_thread = NULL;
+	start_world();
+
+	delete_seg_buf(thread->shadow);
+	free(thread);
+}
+
+void gc_safepoint(void)
+{
+	if (!atomic_load_explicit(&g_is_safepoint_requested,
+	                          memory_order_relaxed)) {
+		return;
+	}
+
+	pthread_mutex_lock(&g_world_lock);
+	if (g_is_world_stopped) {
+		park();
+	}
+	pthread_mutex_unlock(&g_world_lock);
+}
+
+void gc_enter_blocking(void)
+{
+	if (!t_thread) {
+		return;
+	}
+
+	pthread_mutex_lock(&g_world_lock);
+	g_parked_count++;
+	pthread_cond_broadcast(&g_park_cond);
+	pthread_mutex_unlock(&g_world_lock);
+}
+
+void gc_leave_blocking(void)
+{
+	if (!t_thread) {
+		return;
+	}
+
+	pthread_mutex_lock(&g_world_lock);
+	while (g_is_world_stopped) {
+		pthread_cond_wait(&g_resume_cond, &g_world_lock);
+	}
+	g_parked_count--;
+	pthread_mutex_unlock(&g_world_lock);
+}
+
 size_t gc_get_count(void)
 {
-	return g_count;
+	lock_heap();
+	size_t count = slab_get_used_count();
+	unlock_heap();
+
+	return count;
 }
 
-bool gc_is_ready(void)
+size_t gc_get_bytes(void)
 {
-	return g_count >= g_trigger;
+	lock_heap();
+	size_t bytes = slab_get_used_bytes();
+	unlock_heap();
+
+	return bytes;
 }
 
-static Weft_GC *pop_tag(Weft_GC *tag)
+size_t gc_get_live_bytes(void)
 {
-	Weft_GC *prev = get_tag_prev(tag);
-	free(tag);
-	g_count--;
+	return g_live_bytes;
+}
 
-	return prev;
+size_t gc_get_trigger(void)
+{
+	return g_trigger;
 }
 
-static void set_trigger(size_t count)
+void gc_set_growth(double growth)
 {
-	g_trigger = 2 * count;
+	configure_once();
+	if (growth > 1.0) {
+		g_growth = growth;
+	}
+	set_trigger(g_live_bytes);
 }
 
-void gc_collect(void)
+void gc_set_min_heap(size_t bytes)
+{
+	configure_once();
+	g_min_heap = bytes;
+	set_trigger(g_live_bytes);
+}
+
+void gc_set_max_heap(size_t bytes)
+{
+	configure_once();
+	g_max_heap = bytes;
+	set_trigger(g_live_bytes);
+}
+
+void gc_set_nursery(size_t bytes)
 {
-	while (g_heap && !is_tag_marked(g_heap)) {
-		g_heap = pop_tag(g_heap);
+	configure_once();
+	g_nursery = bytes;
+}
+
+void gc_set_incremental(bool is_incremental)
+{
+	configure_once();
+	g_is_incremental = is_incremental;
+}
+
+void gc_set_step(size_t bytes)
+{
+	configure_once();
+	if (bytes) {
+		g_step = bytes;
 	}
+}
+
+void gc_set_max_pause(double seconds)
+{
+	configure_once();
+	g_max_pause = seconds;
+}
 
-	for (Weft_GC *tag = g_heap; tag; tag = get_tag_prev(tag)) {
-		while (get_tag_prev(tag) && !is_tag_marked(get_tag_prev(tag))) {
-			set_tag_prev(tag, pop_tag(get_tag_prev(tag)));
+void gc_set_lazy_sweep(bool is_lazy)
+{
+	configure_once();
+	g_is_lazy_sweep = is_lazy;
+}
+
+void gc_set_background_sweep(bool is_background)
+{
+	configure_once();
+	if (is_background && !g_has_sweeper) {
+		start_sweeper();
+	} else if (!is_background && g_has_sweeper) {
+		stop_sweeper();
+	}
+	g_is_background_sweep = is_background;
+}
+
+void gc_set_compaction(bool is_compacting)
+{
+	configure_once();
+	g_is_compacting = is_compacting;
+}
+
+void gc_set_compact_threshold(double fragmentation)
+{
+	configure_once();
+	g_compact_threshold = fragmentation;
+}
+
+void gc_set_mark_threads(size_t count)
+{
+	configure_once();
+	mark_set_threads(count);
+}
+
+size_t gc_get_mark_threads(void)
+{
+	return mark_get_threads();
+}
+
+double gc_get_longest_pause(void)
+{
+	return g_stats.longest_pause;
+}
+
+void gc_get_stats(Weft_GCStats *stats)
+{
+	lock_heap();
+	*stats = g_stats;
+	stats->live_count = g_live_count;
+	stats->live_bytes = g_live_bytes;
+	stats->freed_count = slab_get_freed_count();
+	stats->freed_bytes = slab_get_freed_bytes();
+	stats->heap_bytes = slab_get_mapped_bytes();
+	stats->peak_heap_bytes = slab_get_peak_mapped_bytes();
+	unlock_heap();
+}
+
+void gc_set_trace(FILE *file)
+{
+	configure_once();
+	g_trace_file = file;
+}
+
+void gc_set_oom_fn(Weft_GCOomFn oom_fn)
+{
+	g_oom_fn = oom_fn;
+}
+
+bool gc_is_major_next(void)
+{
+	return g_is_major_next;
+}
+
+bool gc_is_ready(void)
+{
+	switch (g_phase) {
+	case WEFT_GC_MARK:
+		return !g_is_incremental;
+	case WEFT_GC_REMARK:
+		return true;
+	case WEFT_GC_SWEEP:
+		if (!is_over_trigger()) {
+			return false;
 		}
-		unmark_tag(tag);
+		finish_sweep();
+		return is_over_trigger();
+	default:
+		return is_over_trigger();
+	}
+}
+
+static void write_trace(double pause)
+{
+	Weft_GCStats stats;
+	gc_get_stats(&stats);
+
+	fprintf(g_trace_file,
+	        "gc n=%zu kind=%s time=%.6f pause_us=%.1f mark_us=%.1f "
+	        "live_count=%zu live_bytes=%zu heap_bytes=%zu "
+	        "allocated_bytes=%zu freed_bytes=%zu trigger=%zu\n",
+	        stats.collections,
+	        g_is_major ? "major" : "minor",
+	        get_time() - g_start_time,
+	        pause * 1e6,
+	        g_cycle_mark_time * 1e6,
+	        stats.live_count,
+	        stats.live_bytes,
+	        stats.heap_bytes,
+	        stats.allocated_bytes,
+	        stats.freed_bytes,
+	        g_trigger);
+	fflush(g_trace_file);
+}
+
+void gc_collect(void)
+{
+	configure_once();
+	double start = get_time();
+	double sweep_time = t_sweep_time;
+	bool is_cycle_done = false;
+
+	stop_world();
+	flush_all_tlabs();
+	switch (g_phase) {
+	case WEFT_GC_SWEEP:
+		finish_sweep();
+		// fallthrough
+	case WEFT_GC_IDLE:
+		begin_mark();
+		if (g_is_incremental) {
+			break;
+		}
+		// fallthrough
+	case WEFT_GC_MARK:
+	case WEFT_GC_REMARK:
+		mark_roots();
+		drain_all(start);
+		visit_weak(clear_slot);
+		if (g_is_major && g_is_compacting) {
+			compact();
+		}
+		begin_sweep();
+		trim_bufs();
+		is_cycle_done = true;
+		if (!g_is_incremental && !g_is_lazy_sweep && !g_has_sweeper) {
+			finish_sweep();
+		}
+		break;
+	}
+	start_world();
+
+	double pause = record_pause(start, sweep_time);
+	if (is_cycle_done && g_trace_file) {
+		write_trace(pause);
 	}
-	set_trigger(g_count);
 }
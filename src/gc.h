@@ -4,28 +4,109 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 // Forward Declarations
 
-typedef struct weft_gc Weft_GC;
+typedef enum weft_gc_phase Weft_GCPhase;
+typedef struct weft_gc_stats Weft_GCStats;
+typedef uint8_t Weft_GCType;
+typedef void (*Weft_GCVisitFn)(void *slot);
+typedef void (*Weft_GCTraceFn)(void *ptr, Weft_GCVisitFn visit);
+typedef void (*Weft_GCFinalizeFn)(void *ptr);
+typedef void (*Weft_GCWeakFn)(Weft_GCVisitFn visit);
+typedef void (*Weft_GCOomFn)(size_t size);
 
-// Data Structures
+// Constants
 
-struct weft_gc {
-	uintptr_t prev;
-	char ptr[];
-};
+#define WEFT_GC_PREFETCH_DEPTH 8
+#define WEFT_GC_PAUSE_BUCKETS 16
 
-// Constants
+static const size_t WEFT_GC_MIN_HEAP = 1 << 20;
+static const double WEFT_GC_GROWTH = 2.0;
+static const size_t WEFT_GC_MAX_HEAP = 0;
+static const size_t WEFT_GC_NURSERY = 1 << 18;
+static const size_t WEFT_GC_STEP = 1 << 16;
+static const double WEFT_GC_MAX_PAUSE = 0.0005;
+static const double WEFT_GC_COMPACT_THRESHOLD = 0.5;
+static const double WEFT_GC_COMPACT_OCCUPANCY = 0.5;
+static const Weft_GCType WEFT_GC_LEAF = 0;
+
+// Data Types
 
-static const size_t WEFT_GC_INIT_TRIGGER = 8;
+enum weft_gc_phase {
+	WEFT_GC_IDLE,
+	WEFT_GC_MARK,
+	WEFT_GC_REMARK,
+	WEFT_GC_SWEEP,
+};
+
+// Pause bucket 0 counts pauses under 1us, bucket n counts pauses in
+// [2^(n-1), 2^n) us and the last bucket counts everything longer.
+struct weft_gc_stats {
+	size_t collections;
+	size_t major_collections;
+	size_t compactions;
+	size_t allocated_count;
+	size_t allocated_bytes;
+	size_t live_count;
+	size_t live_bytes;
+	size_t freed_count;
+	size_t freed_bytes;
+	size_t heap_bytes;
+	size_t peak_heap_bytes;
+	double mark_time;
+	double sweep_time;
+	double pause_time;
+	double longest_pause;
+	size_t pause_count;
+	size_t pause_histogram[WEFT_GC_PAUSE_BUCKETS];
+};
 
 // Functions
 
 int gc_error(void);
+Weft_GCType gc_new_type(Weft_GCTraceFn trace);
+void gc_set_finalizer(Weft_GCType type, Weft_GCFinalizeFn finalize);
+void *gc_alloc_typed(size_t size, Weft_GCType type);
 void *gc_alloc(size_t size);
+// Marks ptr as a root for the current cycle. Compaction never moves an
+// object marked this way; objects reached only through registered slots
+// and trace callbacks may move.
 bool gc_mark(void *ptr);
+void gc_write_barrier(void *obj, void *value);
+void gc_add_root(void *slot);
+void gc_remove_root(void *slot);
+void gc_add_weak(Weft_GCWeakFn weak);
+void gc_push_root(void *slot);
+void gc_pop_roots(size_t count);
+void gc_register_thread(void);
+void gc_unregister_thread(void);
+void gc_safepoint(void);
+void gc_enter_blocking(void);
+void gc_leave_blocking(void);
 size_t gc_get_count(void);
+size_t gc_get_bytes(void);
+size_t gc_get_live_bytes(void);
+size_t gc_get_trigger(void);
+void gc_set_growth(double growth);
+void gc_set_min_heap(size_t bytes);
+void gc_set_max_heap(size_t bytes);
+void gc_set_nursery(size_t bytes);
+void gc_set_incremental(bool is_incremental);
+void gc_set_step(size_t bytes);
+void gc_set_max_pause(double seconds);
+void gc_set_lazy_sweep(bool is_lazy);
+void gc_set_background_sweep(bool is_background);
+void gc_set_compaction(bool is_compacting);
+void gc_set_compact_threshold(double fragmentation);
+void gc_set_mark_threads(size_t count);
+size_t gc_get_mark_threads(void);
+double gc_get_longest_pause(void);
+void gc_get_stats(Weft_GCStats *stats);
+void gc_set_trace(FILE *file);
+void gc_set_oom_fn(Weft_GCOomFn oom_fn);
+bool gc_is_major_next(void);
 bool gc_is_ready(void);
 void gc_collect(void);
 
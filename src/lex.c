@@ -0,0 +1,347 @@
+#include "lex.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define WEFT_LEX_HAS_X86 1
+#include <immintrin.h>
+#else
+#define WEFT_LEX_HAS_X86 0
+#endif
+
+// Globals
+
+static Weft_LexIsa g_isa = WEFT_LEX_SCALAR;
+static Weft_LexKernels g_kernels;
+
+// Functions
+
+#define SCALAR_SCAN(name, test)                                                \
+	static size_t name(const char *src)                                        \
+	{                                                                          \
+		size_t len = 0;                                                        \
+		while (test) {                                                         \
+			len++;                                                             \
+		}                                                                      \
+		return len;                                                            \
+	}
+
+// Short tokens are cheaper to finish with the class table, so the vector
+// loop only starts after WEFT_LEX_SCALAR_HEAD bytes. Its first block is
+// loaded from the aligned address below the start and the bits for the
+// bytes before the start are shifted out.
+#define VECTOR_SCAN(name, attrs, width, stop_fn, test)                         \
+	attrs static size_t name(const char *src)                                  \
+	{                                                                          \
+		size_t len = 0;                                                        \
+		for (; len < WEFT_LEX_SCALAR_HEAD; len++) {                            \
+			if (!(test)) {                                                     \
+				return len;                                                    \
+			}                                                                  \
+		}                                                                      \
+                                                                               \
+		size_t offset = (uintptr_t)(src + len) & (width - 1);                  \
+		const char *block = src + len - offset;                                \
+		uint32_t mask = stop_fn(block) >> offset;                              \
+		if (mask) {                                                            \
+			return len + __builtin_ctz(mask);                                  \
+		}                                                                      \
+                                                                               \
+		while (true) {                                                         \
+			block += width;                                                    \
+			if ((mask = stop_fn(block))) {                                     \
+				return block - src + __builtin_ctz(mask);                      \
+			}                                                                  \
+		}                                                                      \
+	}
+
+#define SPACE_TEST lex_is(src[len], WEFT_LEX_SPACE)
+#define LINE_TEST !lex_is(src[len], WEFT_LEX_LINE_END)
+#define DELIM_TEST !lex_is(src[len], WEFT_LEX_DELIM)
+#define WORD_TEST !lex_is(src[len], WEFT_LEX_DELIM | WEFT_LEX_RESTRICTED)
+#define MEMBER_TEST                                                            \
+	!lex_is(src[len], WEFT_LEX_DELIM | WEFT_LEX_RESTRICTED | WEFT_LEX_PIVOT)
+#define STR_TEST !lex_is(src[len], WEFT_LEX_STR_STOP)
+
+SCALAR_SCAN(scalar_skip_space, SPACE_TEST)
+SCALAR_SCAN(scalar_find_line_end, LINE_TEST)
+SCALAR_SCAN(scalar_find_delim, DELIM_TEST)
+SCALAR_SCAN(scalar_find_word_end, WORD_TEST)
+SCALAR_SCAN(scalar_find_member_end, MEMBER_TEST)
+SCALAR_SCAN(scalar_find_str_stop, STR_TEST)
+
+static const Weft_LexKernels SCALAR_KERNELS = {
+	scalar_skip_space,
+	scalar_find_line_end,
+	scalar_find_delim,
+	scalar_find_word_end,
+	scalar_find_member_end,
+	scalar_find_str_stop,
+};
+
+#if WEFT_LEX_HAS_X86
+
+#define SSE2 __attribute__((target("sse2"), no_sanitize_address))
+
+SSE2 static inline __m128i sse2_eq(__m128i x, char c)
+{
+	return _mm_cmpeq_epi8(x, _mm_set1_epi8(c));
+}
+
+SSE2 static inline __m128i sse2_space(__m128i x)
+{
+	__m128i control = _mm_sub_epi8(x, _mm_set1_epi8('\t'));
+	__m128i limit = _mm_set1_epi8('\r' - '\t');
+	return _mm_or_si128(
+		sse2_eq(x, ' '),
+		_mm_cmpeq_epi8(_mm_max_epu8(control, limit), limit));
+}
+
+SSE2 static inline __m128i sse2_delim(__m128i x)
+{
+	__m128i stop = _mm_or_si128(sse2_space(x), sse2_eq(x, '\0'));
+	stop = _mm_or_si128(stop, sse2_eq(x, ']'));
+	stop = _mm_or_si128(stop, sse2_eq(x, '}'));
+	stop = _mm_or_si128(stop, sse2_eq(x, ')'));
+	return _mm_or_si128(stop, sse2_eq(x, ':'));
+}
+
+SSE2 static inline __m128i sse2_word(__m128i x)
+{
+	__m128i stop = _mm_or_si128(sse2_delim(x), sse2_eq(x, '['));
+	stop = _mm_or_si128(stop, sse2_eq(x, '{'));
+	return _mm_or_si128(stop, sse2_eq(x, '('));
+}
+
+SSE2 static inline __m128i sse2_load(const char *block)
+{
+	return _mm_load_si128((const __m128i *)block);
+}
+
+SSE2 static inline uint32_t sse2_space_stop(const char *block)
+{
+	return ~_mm_movemask_epi8(sse2_space(sse2_load(block))) & 0xffff;
+}
+
+SSE2 static inline uint32_t sse2_line_stop(const char *block)
+{
+	__m128i x = sse2_load(block);
+	return _mm_movemask_epi8(_mm_or_si128(sse2_eq(x, '\0'), sse2_eq(x, '\n')));
+}
+
+SSE2 static inline uint32_t sse2_delim_stop(const char *block)
+{
+	return _mm_movemask_epi8(sse2_delim(sse2_load(block)));
+}
+
+SSE2 static inline uint32_t sse2_word_stop(const char *block)
+{
+	return _mm_movemask_epi8(sse2_word(sse2_load(block)));
+}
+
+SSE2 static inline uint32_t sse2_member_stop(const char *block)
+{
+	__m128i x = sse2_load(block);
+	return _mm_movemask_epi8(_mm_or_si128(sse2_word(x), sse2_eq(x, '-')));
+}
+
+SSE2 static inline uint32_t sse2_str_stop(const char *block)
+{
+	__m128i x = sse2_load(block);
+	__m128i stop = _mm_or_si128(sse2_eq(x, '\0'), sse2_eq(x, '"'));
+	return _mm_movemask_epi8(_mm_or_si128(stop, sse2_eq(x, '\\')));
+}
+
+VECTOR_SCAN(sse2_skip_space, SSE2, 16, sse2_space_stop, SPACE_TEST)
+VECTOR_SCAN(sse2_find_line_end, SSE2, 16, sse2_line_stop, LINE_TEST)
+VECTOR_SCAN(sse2_find_delim, SSE2, 16, sse2_delim_stop, DELIM_TEST)
+VECTOR_SCAN(sse2_find_word_end, SSE2, 16, sse2_word_stop, WORD_TEST)
+VECTOR_SCAN(sse2_find_member_end, SSE2, 16, sse2_member_stop, MEMBER_TEST)
+VECTOR_SCAN(sse2_find_str_stop, SSE2, 16, sse2_str_stop, STR_TEST)
+
+static const Weft_LexKernels SSE2_KERNELS = {
+	sse2_skip_space,
+	sse2_find_line_end,
+	sse2_find_delim,
+	sse2_find_word_end,
+	sse2_find_member_end,
+	sse2_find_str_stop,
+};
+
+#define AVX2 __attribute__((target("avx2"), no_sanitize_address))
+
+AVX2 static inline __m256i avx2_eq(__m256i x, char c)
+{
+	return _mm256_cmpeq_epi8(x, _mm256_set1_epi8(c));
+}
+
+AVX2 static inline __m256i avx2_space(__m256i x)
+{
+	__m256i control = _mm256_sub_epi8(x, _mm256_set1_epi8('\t'));
+	__m256i limit = _mm256_set1_epi8('\r' - '\t');
+	return _mm256_or_si256(
+		avx2_eq(x, ' '),
+		_mm256_cmpeq_epi8(_mm256_max_epu8(control, limit), limit));
+}
+
+AVX2 static inline __m256i avx2_delim(__m256i x)
+{
+	__m256i stop = _mm256_or_si256(avx2_space(x), avx2_eq(x, '\0'));
+	stop = _mm256_or_si256(stop, avx2_eq(x, ']'));
+	stop = _mm256_or_si256(stop, avx2_eq(x, '}'));
+	stop = _mm256_or_si256(stop, avx2_eq(x, ')'));
+	return _mm256_or_si256(stop, avx2_eq(x, ':'));
+}
+
+AVX2 static inline __m256i avx2_word(__m256i x)
+{
+	__m256i stop = _mm256_or_si256(avx2_delim(x), avx2_eq(x, '['));
+	stop = _mm256_or_si256(stop, avx2_eq(x, '{'));
+	return _mm256_or_si256(stop, avx2_eq(x, '('));
+}
+
+AVX2 static inline __m256i avx2_load(const char *block)
+{
+	return _mm256_load_si256((const __m256i *)block);
+}
+
+AVX2 static inline uint32_t avx2_space_stop(const char *block)
+{
+	return ~(uint32_t)_mm256_movemask_epi8(avx2_space(avx2_load(block)));
+}
+
+AVX2 static inline uint32_t avx2_line_stop(const char *block)
+{
+	__m256i x = avx2_load(block);
+	return _mm256_movemask_epi8(
+		_mm256_or_si256(avx2_eq(x, '\0'), avx2_eq(x, '\n')));
+}
+
+AVX2 static inline uint32_t avx2_delim_stop(const char *block)
+{
+	return _mm256_movemask_epi8(avx2_delim(avx2_load(block)));
+}
+
+AVX2 static inline uint32_t avx2_word_stop(const char *block)
+{
+	return _mm256_movemask_epi8(avx2_word(avx2_load(block)));
+}
+
+AVX2 static inline uint32_t avx2_member_stop(const char *block)
+{
+	__m256i x = avx2_load(block);
+	return _mm256_movemask_epi8(
+		_mm256_or_si256(avx2_word(x), avx2_eq(x, '-')));
+}
+
+AVX2 static inline uint32_t avx2_str_stop(const char *block)
+{
+	__m256i x = avx2_load(block);
+	__m256i stop = _mm256_or_si256(avx2_eq(x, '\0'), avx2_eq(x, '"'));
+	return _mm256_movemask_epi8(_mm256_or_si256(stop, avx2_eq(x, '\\')));
+}
+
+VECTOR_SCAN(avx2_skip_space, AVX2, 32, avx2_space_stop, SPACE_TEST)
+VECTOR_SCAN(avx2_find_line_end, AVX2, 32, avx2_line_stop, LINE_TEST)
+VECTOR_SCAN(avx2_find_delim, AVX2, 32, avx2_delim_stop, DELIM_TEST)
+VECTOR_SCAN(avx2_find_word_end, AVX2, 32, avx2_word_stop, WORD_TEST)
+VECTOR_SCAN(avx2_find_member_end, AVX2, 32, avx2_member_stop, MEMBER_TEST)
+VECTOR_SCAN(avx2_find_str_stop, AVX2, 32, avx2_str_stop, STR_TEST)
+
+static const Weft_LexKernels AVX2_KERNELS = {
+	avx2_skip_space,
+	avx2_find_line_end,
+	avx2_find_delim,
+	avx2_find_word_end,
+	avx2_find_member_end,
+	avx2_find_str_stop,
+};
+
+#endif
+
+static bool is_isa_supported(Weft_LexIsa isa)
+{
+#if WEFT_LEX_HAS_X86
+	__builtin_cpu_init();
+	switch (isa) {
+	case WEFT_LEX_AVX2:
+		return __builtin_cpu_supports("avx2");
+	case WEFT_LEX_SSE2:
+		return __builtin_cpu_supports("sse2");
+	default:
+		return true;
+	}
+#else
+	return isa == WEFT_LEX_SCALAR;
+#endif
+}
+
+void lex_set_isa(Weft_LexIsa isa)
+{
+	while (!is_isa_supported(isa)) {
+		isa--;
+	}
+
+	g_isa = isa;
+	switch (isa) {
+#if WEFT_LEX_HAS_X86
+	case WEFT_LEX_AVX2:
+		g_kernels = AVX2_KERNELS;
+		break;
+	case WEFT_LEX_SSE2:
+		g_kernels = SSE2_KERNELS;
+		break;
+#endif
+	default:
+		g_kernels = SCALAR_KERNELS;
+		break;
+	}
+}
+
+Weft_LexIsa lex_get_isa(void)
+{
+	return g_isa;
+}
+
+__attribute__((constructor)) static void init_lex(void)
+{
+	const char *value = getenv("WEFT_LEX_ISA");
+	if (!value || !strcmp(value, "avx2")) {
+		lex_set_isa(WEFT_LEX_AVX2);
+	} else if (!strcmp(value, "sse2")) {
+		lex_set_isa(WEFT_LEX_SSE2);
+	} else {
+		lex_set_isa(WEFT_LEX_SCALAR);
+	}
+}
+
+size_t lex_skip_space(const char *src)
+{
+	return g_kernels.skip_space(src);
+}
+
+size_t lex_find_line_end(const char *src)
+{
+	return g_kernels.find_line_end(src);
+}
+
+size_t lex_find_delim(const char *src)
+{
+	return g_kernels.find_delim(src);
+}
+
+size_t lex_find_word_end(const char *src)
+{
+	return g_kernels.find_word_end(src);
+}
+
+size_t lex_find_member_end(const char *src)
+{
+	return g_kernels.find_member_end(src);
+}
+
+size_t lex_find_str_stop(const char *src)
+{
+	return g_kernels.find_str_stop(src);
+}
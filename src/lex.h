@@ -0,0 +1,80 @@
+#ifndef WEFT_LEX_H
+#define WEFT_LEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Forward Declarations
+
+typedef enum weft_lex_isa Weft_LexIsa;
+typedef struct weft_lex_kernels Weft_LexKernels;
+typedef size_t (*Weft_LexScanFn)(const char *src);
+
+// Constants
+
+#define WEFT_LEX_SPACE 0x01
+#define WEFT_LEX_DELIM 0x02
+#define WEFT_LEX_RESTRICTED 0x04
+#define WEFT_LEX_LINE_END 0x08
+#define WEFT_LEX_PIVOT 0x10
+#define WEFT_LEX_STR_STOP 0x20
+
+static const size_t WEFT_LEX_SCALAR_HEAD = 16;
+
+static const uint8_t WEFT_LEX_CLASS[256] = {
+	['\0'] = WEFT_LEX_DELIM | WEFT_LEX_LINE_END | WEFT_LEX_STR_STOP,
+	['\t'] = WEFT_LEX_SPACE | WEFT_LEX_DELIM,
+	['\n'] = WEFT_LEX_SPACE | WEFT_LEX_DELIM | WEFT_LEX_LINE_END,
+	['\v'] = WEFT_LEX_SPACE | WEFT_LEX_DELIM,
+	['\f'] = WEFT_LEX_SPACE | WEFT_LEX_DELIM,
+	['\r'] = WEFT_LEX_SPACE | WEFT_LEX_DELIM,
+	[' '] = WEFT_LEX_SPACE | WEFT_LEX_DELIM,
+	[']'] = WEFT_LEX_DELIM | WEFT_LEX_RESTRICTED,
+	['}'] = WEFT_LEX_DELIM | WEFT_LEX_RESTRICTED,
+	[')'] = WEFT_LEX_DELIM | WEFT_LEX_RESTRICTED,
+	[':'] = WEFT_LEX_DELIM | WEFT_LEX_RESTRICTED,
+	['['] = WEFT_LEX_RESTRICTED,
+	['{'] = WEFT_LEX_RESTRICTED,
+	['('] = WEFT_LEX_RESTRICTED,
+	['-'] = WEFT_LEX_PIVOT,
+	['"'] = WEFT_LEX_STR_STOP,
+	['\\'] = WEFT_LEX_STR_STOP,
+};
+
+// Data Types
+
+enum weft_lex_isa {
+	WEFT_LEX_SCALAR,
+	WEFT_LEX_SSE2,
+	WEFT_LEX_AVX2,
+};
+
+// Every kernel stops at the NUL terminator. The vector kernels only load
+// aligned blocks, so they never read past the page holding the NUL.
+struct weft_lex_kernels {
+	Weft_LexScanFn skip_space;
+	Weft_LexScanFn find_line_end;
+	Weft_LexScanFn find_delim;
+	Weft_LexScanFn find_word_end;
+	Weft_LexScanFn find_member_end;
+	Weft_LexScanFn find_str_stop;
+};
+
+// Functions
+
+void lex_set_isa(Weft_LexIsa isa);
+Weft_LexIsa lex_get_isa(void);
+size_t lex_skip_space(const char *src);
+size_t lex_find_line_end(const char *src);
+size_t lex_find_delim(const char *src);
+size_t lex_find_word_end(const char *src);
+size_t lex_find_member_end(const char *src);
+size_t lex_find_str_stop(const char *src);
+
+static inline bool lex_is(char c, uint8_t class)
+{
+	return WEFT_LEX_CLASS[(uint8_t)c] & class;
+}
+
+#endif
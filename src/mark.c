@@ -0,0 +1,350 @@
+#include "mark.h"
+#include "slab.h"
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Globals
+
+Weft_MarkWorker g_workers[WEFT_MARK_MAX_THREADS];
+size_t g_thread_count = 1;
+size_t g_started_count = 1;
+const Weft_GCTraceFn *g_mark_trace;
+_Atomic size_t g_idle_count = 0;
+size_t g_generation = 0;
+size_t g_done_count = 0;
+bool g_is_pool_stopping = false;
+pthread_mutex_t g_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t g_start_cond = PTHREAD_COND_INITIALIZER;
+pthread_cond_t g_done_cond = PTHREAD_COND_INITIALIZER;
+_Thread_local Weft_MarkWorker *t_worker;
+
+// Functions
+
+static Weft_MarkArray *new_array(int64_t cap)
+{
+	Weft_MarkArray *array =
+		malloc(sizeof(Weft_MarkArray) + cap * sizeof(array->slot[0]));
+	if (!array) {
+		exit(gc_error());
+	}
+
+	array->retired = NULL;
+	array->cap = cap;
+	return array;
+}
+
+static void init_deque(Weft_MarkDeque *deque)
+{
+	atomic_init(&deque->top, 0);
+	atomic_init(&deque->bottom, 0);
+	atomic_init(&deque->array, new_array(WEFT_MARK_DEQUE_INIT_CAP));
+}
+
+static void reset_deque(Weft_MarkDeque *deque)
+{
+	Weft_MarkArray *array = atomic_load(&deque->array);
+	while (array->retired) {
+		Weft_MarkArray *retired = array->retired;
+		array->retired = retired->retired;
+		free(retired);
+	}
+	atomic_store(&deque->top, 0);
+	atomic_store(&deque->bottom, 0);
+}
+
+static Weft_MarkArray *
+grow_deque(Weft_MarkDeque *deque, Weft_MarkArray *array, int64_t top,
+           int64_t bottom)
+{
+	Weft_MarkArray *grown = new_array(array->cap * 2);
+	for (int64_t i = top; i < bottom; i++) {
+		void *ptr = atomic_load_explicit(&array->slot[i % array->cap],
+		                                 memory_order_relaxed);
+		atomic_store_explicit(&grown->slot[i % grown->cap],
+		                      ptr,
+		                      memory_order_relaxed);
+	}
+
+	// Thieves may still be reading the old array until the drain ends.
+	grown->retired = array;
+	atomic_store_explicit(&deque->array, grown, memory_order_release);
+	return grown;
+}
+
+static void push_deque(Weft_MarkDeque *deque, void *ptr)
+{
+	int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+	int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+	Weft_MarkArray *array =
+		atomic_load_explicit(&deque->array, memory_order_relaxed);
+	if (bottom - top >= array->cap) {
+		array = grow_deque(deque, array, top, bottom);
+	}
+
+	atomic_store_explicit(&array->slot[bottom % array->cap],
+	                      ptr,
+	                      memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+}
+
+static void *take_deque(Weft_MarkDeque *deque)
+{
+	int64_t bottom =
+		atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+	Weft_MarkArray *array =
+		atomic_load_explicit(&deque->array, memory_order_relaxed);
+	atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+	int64_t top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+	if (top > bottom) {
+		atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+		return NULL;
+	}
+
+	void *ptr = atomic_load_explicit(&array->slot[bottom % array->cap],
+	                                 memory_order_relaxed);
+	if (top == bottom) {
+		if (!atomic_compare_exchange_strong_explicit(&deque->top,
+		                                             &top,
+		                                             top + 1,
+		                                             memory_order_seq_cst,
+		                                             memory_order_relaxed)) {
+			ptr = NULL;
+		}
+		atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+	}
+	return ptr;
+}
+
+static void *steal_deque(Weft_MarkDeque *deque)
+{
+	int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+	atomic_thread_fence(memory_order_seq_cst);
+	int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+	if (top >= bottom) {
+		return NULL;
+	}
+
+	Weft_MarkArray *array =
+		atomic_load_explicit(&deque->array, memory_order_acquire);
+	void *ptr = atomic_load_explicit(&array->slot[top % array->cap],
+	                                 memory_order_relaxed);
+	if (!atomic_compare_exchange_strong_explicit(&deque->top,
+	                                             &top,
+	                                             top + 1,
+	                                             memory_order_seq_cst,
+	                                             memory_order_relaxed)) {
+		return NULL;
+	}
+	return ptr;
+}
+
+static bool is_deque_empty(Weft_MarkDeque *deque)
+{
+	int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+	int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+	return top >= bottom;
+}
+
+static uint64_t next_random(Weft_MarkWorker *worker)
+{
+	worker->seed ^= worker->seed << 13;
+	worker->seed ^= worker->seed >> 7;
+	worker->seed ^= worker->seed << 17;
+	return worker->seed;
+}
+
+static void mark_slot(void *slot)
+{
+	void *ptr = *(void **)slot;
+	if (!ptr || slab_mark_atomic(ptr)) {
+		return;
+	}
+
+	t_worker->marked_count++;
+	t_worker->marked_bytes += slab_get_size(ptr);
+	if (g_mark_trace[slab_get_type(ptr)]) {
+		push_deque(&t_worker->deque, ptr);
+	}
+}
+
+static void *take_work(Weft_MarkWorker *worker)
+{
+	void *ptr = take_deque(&worker->deque);
+	if (ptr) {
+		return ptr;
+	}
+
+	size_t offset = next_random(worker) % g_thread_count;
+	for (size_t i = 0; i < g_thread_count; i++) {
+		size_t victim = (offset + i) % g_thread_count;
+		if (victim != worker->id
+		    && (ptr = steal_deque(&g_workers[victim].deque))) {
+			return ptr;
+		}
+	}
+	return NULL;
+}
+
+static bool has_work(void)
+{
+	for (size_t i = 0; i < g_thread_count; i++) {
+		if (!is_deque_empty(&g_workers[i].deque)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void run_worker(Weft_MarkWorker *worker)
+{
+	t_worker = worker;
+	while (true) {
+		void *ptr = take_work(worker);
+		if (ptr) {
+			__builtin_prefetch(ptr);
+			g_mark_trace[slab_get_type(ptr)](ptr, mark_slot);
+			continue;
+		}
+
+		atomic_fetch_add(&g_idle_count, 1);
+		while (!has_work()) {
+			if (atomic_load(&g_idle_count) == g_thread_count) {
+				return;
+			}
+			sched_yield();
+		}
+		atomic_fetch_sub(&g_idle_count, 1);
+	}
+}
+
+static void *run_thread(void *arg)
+{
+	Weft_MarkWorker *worker = arg;
+
+	pthread_mutex_lock(&g_pool_lock);
+	while (true) {
+		while (worker->generation == g_generation && !g_is_pool_stopping) {
+			pthread_cond_wait(&g_start_cond, &g_pool_lock);
+		}
+		if (g_is_pool_stopping) {
+			break;
+		}
+
+		worker->generation = g_generation;
+		pthread_mutex_unlock(&g_pool_lock);
+		run_worker(worker);
+		pthread_mutex_lock(&g_pool_lock);
+
+		g_done_count++;
+		pthread_cond_signal(&g_done_cond);
+	}
+	pthread_mutex_unlock(&g_pool_lock);
+
+	return NULL;
+}
+
+static void init_worker(size_t id)
+{
+	Weft_MarkWorker *worker = &g_workers[id];
+	if (atomic_load(&worker->deque.array)) {
+		return;
+	}
+
+	init_deque(&worker->deque);
+	worker->id = id;
+	worker->seed = 0x9e3779b97f4a7c15 * (id + 1);
+}
+
+static void start_workers(void)
+{
+	init_worker(0);
+	while (g_started_count < g_thread_count) {
+		Weft_MarkWorker *worker = &g_workers[g_started_count];
+		init_worker(g_started_count);
+		worker->generation = g_generation;
+		if (pthread_create(&worker->thread, NULL, run_thread, worker)) {
+			perror("Could not start mark thread");
+			g_thread_count = g_started_count;
+			return;
+		}
+		g_started_count++;
+	}
+}
+
+static void stop_workers(void)
+{
+	pthread_mutex_lock(&g_pool_lock);
+	g_is_pool_stopping = true;
+	pthread_cond_broadcast(&g_start_cond);
+	pthread_mutex_unlock(&g_pool_lock);
+
+	for (size_t i = 1; i < g_started_count; i++) {
+		pthread_join(g_workers[i].thread, NULL);
+	}
+	g_started_count = 1;
+	g_is_pool_stopping = false;
+}
+
+void mark_set_threads(size_t count)
+{
+	if (!count) {
+		count = 1;
+	} else if (count > WEFT_MARK_MAX_THREADS) {
+		count = WEFT_MARK_MAX_THREADS;
+	}
+
+	if (g_started_count > count) {
+		stop_workers();
+	}
+	g_thread_count = count;
+}
+
+size_t mark_get_threads(void)
+{
+	return g_thread_count;
+}
+
+void mark_drain(void **seeds,
+                size_t count,
+                const Weft_GCTraceFn *trace,
+                size_t *marked_count_p,
+                size_t *marked_bytes_p)
+{
+	g_mark_trace = trace;
+	start_workers();
+
+	for (size_t i = 0; i < g_thread_count; i++) {
+		g_workers[i].marked_count = 0;
+		g_workers[i].marked_bytes = 0;
+	}
+	for (size_t i = 0; i < count; i++) {
+		push_deque(&g_workers[i % g_thread_count].deque, seeds[i]);
+	}
+	atomic_store(&g_idle_count, 0);
+
+	pthread_mutex_lock(&g_pool_lock);
+	g_generation++;
+	g_done_count = 0;
+	pthread_cond_broadcast(&g_start_cond);
+	pthread_mutex_unlock(&g_pool_lock);
+
+	run_worker(&g_workers[0]);
+
+	pthread_mutex_lock(&g_pool_lock);
+	while (g_done_count < g_thread_count - 1) {
+		pthread_cond_wait(&g_done_cond, &g_pool_lock);
+	}
+	pthread_mutex_unlock(&g_pool_lock);
+
+	for (size_t i = 0; i < g_thread_count; i++) {
+		*marked_count_p += g_workers[i].marked_count;
+		*marked_bytes_p += g_workers[i].marked_bytes;
+		reset_deque(&g_workers[i].deque);
+	}
+}
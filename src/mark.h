@@ -0,0 +1,57 @@
+#ifndef WEFT_MARK_H
+#define WEFT_MARK_H
+
+#include "gc.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Forward Declarations
+
+typedef struct weft_mark_array Weft_MarkArray;
+typedef struct weft_mark_deque Weft_MarkDeque;
+typedef struct weft_mark_worker Weft_MarkWorker;
+
+// Constants
+
+#define WEFT_MARK_MAX_THREADS 64
+
+static const size_t WEFT_MARK_DEQUE_INIT_CAP = 1024;
+
+// Data Types
+
+struct weft_mark_array {
+	Weft_MarkArray *retired;
+	int64_t cap;
+	_Atomic(void *) slot[];
+};
+
+struct weft_mark_deque {
+	_Atomic int64_t top;
+	_Atomic int64_t bottom;
+	_Atomic(Weft_MarkArray *) array;
+};
+
+struct weft_mark_worker {
+	Weft_MarkDeque deque;
+	size_t id;
+	size_t marked_count;
+	size_t marked_bytes;
+	size_t generation;
+	uint64_t seed;
+	pthread_t thread;
+};
+
+// Functions
+
+void mark_set_threads(size_t count);
+size_t mark_get_threads(void);
+void mark_drain(void **seeds,
+                size_t count,
+                const Weft_GCTraceFn *trace,
+                size_t *marked_count_p,
+                size_t *marked_bytes_p);
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef WEFT_NUM_H
+#define WEFT_NUM_H
+
+#include <stddef.h>
+
+// Functions
+
+size_t num_scan(const char *src, double *num_p);
+
+#endif
@@ -1,42 +1,221 @@
 #include "parse.h"
+#include "arena.h"
 #include "buf.h"
 #include "gc.h"
+#include "lex.h"
+#include "num.h"
 #include "str.h"
+#include "sym.h"
+#include "utf8.h"
 
 #include <ctype.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-// Constants
+// Globals
 
-static const char delim_list[] = "]}):";
-static const char restricted_char_list[] = "[]{}():";
+static Weft_GCType g_parse_file_type;
+static pthread_once_t g_parse_file_type_once = PTHREAD_ONCE_INIT;
 
 // Functions
 
 #define len_of(str) (sizeof(str) - 1)
 
+static void parse_file_trace(void *ptr, Weft_GCVisitFn visit)
+{
+	Weft_ParseFile *file = ptr;
+	visit(&file->path);
+	if (!file->map_span && !file->is_streamed) {
+		visit(&file->src);
+	}
+
+	if (file->syms) {
+		Weft_Str **syms = buf_get_raw(file->syms);
+		size_t count = buf_get_at(file->syms) / sizeof(Weft_Str *);
+		for (size_t i = 0; i < count; i++) {
+			visit(&syms[i]);
+		}
+	}
+}
+
+static void parse_file_finalize(void *ptr)
+{
+	Weft_ParseFile *file = ptr;
+	parse_file_release(file);
+	if (file->lines) {
+		delete_buf(file->lines);
+	}
+	if (file->syms) {
+		delete_buf(file->syms);
+		delete_buf(file->sym_seen);
+	}
+	if (file->map_span) {
+		munmap(file->src, file->map_span);
+	}
+}
+
+static void init_parse_file_type(void)
+{
+	g_parse_file_type = gc_new_type(parse_file_trace);
+	gc_set_finalizer(g_parse_file_type, parse_file_finalize);
+}
+
+static Weft_GCType get_parse_file_type(void)
+{
+	pthread_once(&g_parse_file_type_once, init_parse_file_type);
+	return g_parse_file_type;
+}
+
 Weft_ParseFile *new_parse_file(char *path, char *src)
 {
-	Weft_ParseFile *file = gc_alloc(sizeof(Weft_ParseFile));
+	Weft_ParseFile *file =
+		gc_alloc_typed(sizeof(Weft_ParseFile), get_parse_file_type());
 	file->path = path;
 	file->src = src;
+	file->map_span = 0;
+	file->is_streamed = false;
+	file->base = (Weft_ParsePos){0, 0};
+	file->arena = new_arena();
+	file->lines = NULL;
+	file->syms = NULL;
+	file->sym_seen = NULL;
+
+	return file;
+}
+
+// Reserves at least one byte past the end of the file as anonymous zero
+// memory, so the source is NUL-terminated without copying it.
+static char *map_src(int fd, size_t size, size_t *span_p)
+{
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	size_t span = (size + page_size) & ~(page_size - 1);
+	char *src = mmap(
+		NULL, span, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (src == MAP_FAILED) {
+		return NULL;
+	}
+
+	if (size && mmap(src, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0)
+	                == MAP_FAILED) {
+		munmap(src, span);
+		return NULL;
+	}
+
+	*span_p = span;
+	return src;
+}
+
+Weft_ParseFile *load_parse_file(const char *path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
 
+	struct stat st;
+	size_t span;
+	char *src = NULL;
+	if (!fstat(fd, &st)) {
+		src = map_src(fd, st.st_size, &span);
+	}
+	close(fd);
+	if (!src) {
+		return NULL;
+	}
+
+	Weft_ParseFile *file = new_parse_file(NULL, src);
+	file->map_span = span;
+
+	size_t path_len = strlen(path);
+	file->path = gc_alloc(path_len + 1);
+	memcpy(file->path, path, path_len + 1);
+
+	size_t invalid = utf8_find_invalid(src, st.st_size);
+	if (invalid < (size_t)st.st_size) {
+		parse_error(file,
+		            src + invalid,
+		            1,
+		            "Invalid UTF-8 byte 0x%02x",
+		            (uint8_t)src[invalid]);
+		return NULL;
+	}
 	return file;
 }
 
 void parse_file_mark(Weft_ParseFile *file)
 {
-	if (gc_mark(file)) {
-		return;
+	gc_mark(file);
+}
+
+void parse_file_release(Weft_ParseFile *file)
+{
+	if (file->arena) {
+		delete_arena(file->arena);
+		file->arena = NULL;
 	}
+}
 
-	gc_mark(file->path);
-	gc_mark(file->src);
+// The line index holds the offset of every line start and is built on the
+// first lookup.
+static Weft_Buf *get_lines(Weft_ParseFile *file)
+{
+	if (file->lines) {
+		return file->lines;
+	}
+
+	const char *src = file->src;
+	Weft_Buf *lines = new_buf(sizeof(size_t));
+	buf_push_size(&lines, 0);
+	for (size_t at = lex_find_line_end(src); src[at];) {
+		at += len_of("\n");
+		buf_push_size(&lines, at);
+		at += lex_find_line_end(src + at);
+	}
+
+	file->lines = lines;
+	return lines;
+}
+
+size_t parse_file_get_line_count(Weft_ParseFile *file)
+{
+	return file->base.line + buf_get_at(get_lines(file)) / sizeof(size_t);
+}
+
+const char *parse_file_get_line(Weft_ParseFile *file, size_t line)
+{
+	const size_t *starts = buf_get_raw(get_lines(file));
+	return file->src + starts[line - file->base.line];
+}
+
+Weft_ParsePos parse_file_get_pos(Weft_ParseFile *file, const char *at)
+{
+	Weft_Buf *lines = get_lines(file);
+	const size_t *starts = buf_get_raw(lines);
+	size_t offset = at - file->src;
+	size_t low = 0;
+	size_t high = buf_get_at(lines) / sizeof(size_t);
+	while (high - low > 1) {
+		size_t mid = low + (high - low) / 2;
+		if (starts[mid] <= offset) {
+			low = mid;
+		} else {
+			high = mid;
+		}
+	}
+	size_t col = offset - starts[low];
+	if (!low) {
+		col += file->base.col;
+	}
+	return (Weft_ParsePos){file->base.line + low, col};
 }
 
 Weft_ParseToken
@@ -74,6 +253,19 @@ void parse_token_mark(Weft_ParseToken token)
 	}
 }
 
+Weft_ParseToken parse_token_promote(Weft_ParseToken token)
+{
+	switch (token.type) {
+	case WEFT_PARSE_STR:
+	case WEFT_PARSE_INCLUDE:
+		token.str = str_promote(token.str);
+		break;
+	default:
+		break;
+	}
+	return token;
+}
+
 static Weft_ParseToken
 tag_error(Weft_ParseFile *file, const char *src, size_t len)
 {
@@ -130,10 +322,37 @@ tag_num(Weft_ParseFile *file, const char *src, size_t len, double num)
 	return token;
 }
 
+// A file keeps every symbol it uses alive, so the symbol IDs in its
+// tokens stay valid for as long as the file does. sym_seen has a bit per
+// symbol ID already in syms.
+static Weft_Str *intern_word(Weft_ParseFile *file, const char *src, size_t len)
+{
+	Weft_Str *word = sym_intern(src, len);
+	if (!file->syms) {
+		file->syms = new_buf(WEFT_BUF_MIN_CAP);
+		file->sym_seen = new_buf(WEFT_BUF_MIN_CAP);
+	}
+
+	size_t byte = word->sym / CHAR_BIT;
+	uint8_t bit = 1 << (word->sym % CHAR_BIT);
+	while (buf_get_at(file->sym_seen) <= byte) {
+		buf_push_byte(&file->sym_seen, 0);
+	}
+
+	uint8_t *seen = buf_get_raw(file->sym_seen);
+	if (!(seen[byte] & bit)) {
+		seen[byte] |= bit;
+		buf_push_ptr(&file->syms, word);
+		gc_write_barrier(file, word);
+	}
+	return word;
+}
+
 static Weft_ParseToken
 tag_word(Weft_ParseFile *file, const char *src, size_t len)
 {
-	return new_parse_token_with_type(file, src, len, WEFT_PARSE_WORD);
+	return tag_ptr(
+		file, src, len, WEFT_PARSE_WORD, intern_word(file, src, len));
 }
 
 static Weft_ParseToken
@@ -142,24 +361,6 @@ tag_include(Weft_ParseFile *file, const char *src, size_t len, Weft_Str *path)
 	return tag_ptr(file, src, len, WEFT_PARSE_INCLUDE, path);
 }
 
-static const char *
-get_line_start(size_t *line_no_p, const char *src, const char *at)
-{
-	const char *line = src;
-	*line_no_p = 0;
-
-	while (src < at) {
-		if (*src == '\n') {
-			src++;
-			line = src;
-			*line_no_p += 1;
-		} else {
-			src++;
-		}
-	}
-	return line;
-}
-
 #define ANSI_FMT_RESET "\e[0m"
 #define ANSI_FMT_ERROR "\e[91;1m"  // Red, Bold
 
@@ -190,11 +391,7 @@ print_error_context_left(size_t line_no, const char *line, const char *src)
 
 static size_t get_line_len(const char *line)
 {
-	size_t len = 0;
-	while (line[len] && line[len] != '\n') {
-		len++;
-	}
-	return len;
+	return lex_find_line_end(line);
 }
 
 static void
@@ -237,15 +434,15 @@ static void print_error_context(size_t line_no,
 Weft_ParseToken parse_error(
 	Weft_ParseFile *file, const char *src, size_t len, const char *fmt, ...)
 {
-	size_t line_no;
-	const char *line = get_line_start(&line_no, file->src, src);
+	Weft_ParsePos pos = parse_file_get_pos(file, src);
+	const char *line = parse_file_get_line(file, pos.line);
 
 	va_list args;
 	va_start(args, fmt);
-	print_error_msg(file->path, line_no, src - line, fmt, args);
+	print_error_msg(file->path, pos.line, pos.col, fmt, args);
 	va_end(args);
 
-	print_error_context(line_no, line, src, len);
+	print_error_context(pos.line, line, src, len);
 
 	return tag_error(file, src, len);
 }
@@ -258,24 +455,19 @@ static bool is_line_comment(const char *src)
 Weft_ParseToken parse_line_comment(Weft_ParseFile *file, const char *src)
 {
 	size_t len = len_of("#");
-	while (src[len] && src[len] != '\n') {
-		len++;
-	}
+	len += lex_find_line_end(src + len);
 	return tag_empty(file, src, len);
 }
 
 Weft_ParseToken parse_empty(Weft_ParseFile *file, const char *src)
 {
-	size_t len = 0;
-	while (true) {
-		if (is_line_comment(src + len)) {
-			len += parse_line_comment(file, src + len).len;
-		} else if (isspace(src[len])) {
-			len++;
-		} else {
-			return tag_empty(file, src, len);
-		}
+	size_t len = lex_skip_space(src);
+	while (is_line_comment(src + len)) {
+		len += len_of("#");
+		len += lex_find_line_end(src + len);
+		len += lex_skip_space(src + len);
 	}
+	return tag_empty(file, src, len);
 }
 
 static bool is_hex_esc(const char *src)
@@ -323,6 +515,30 @@ Weft_ParseToken parse_hex_esc(Weft_ParseFile *file, const char *src)
 	return tag_char(file, src, len, value);
 }
 
+static Weft_ParseToken tag_utf_esc(Weft_ParseFile *file,
+                                   const char *src,
+                                   size_t len,
+                                   long unsigned value)
+{
+	if (value > WEFT_UTF8_MAX) {
+		return parse_error(
+			file,
+			src,
+			len,
+			"Unicode value %lu exceeds the maximum Unicode value of %u.",
+			value,
+			WEFT_UTF8_MAX);
+	} else if (!utf8_is_scalar(value)) {
+		return parse_error(file,
+		                   src,
+		                   len,
+		                   "Unicode value %lu is a surrogate and cannot be "
+		                   "encoded as UTF-8.",
+		                   value);
+	}
+	return tag_char(file, src, len, value);
+}
+
 static bool is_lower_utf_esc(const char *src)
 {
 	return src[0] == '\\' && src[1] == 'u';
@@ -355,7 +571,7 @@ Weft_ParseToken parse_lower_utf_esc(Weft_ParseFile *file, const char *src)
 		value = push_nibble(value, src[len]);
 		len++;
 	}
-	return tag_char(file, src, len, value);
+	return tag_utf_esc(file, src, len, value);
 }
 
 static bool is_upper_utf_esc(const char *src)
@@ -411,17 +627,7 @@ Weft_ParseToken parse_upper_utf_esc(Weft_ParseFile *file, const char *src)
 		len++;
 	}
 
-	const unsigned UTF32_MAX = 2097151;
-	if (value > UTF32_MAX) {
-		return parse_error(
-			file,
-			src,
-			len,
-			"Unicode value %lu exceeds the maximum UTF-32 value of %u.",
-			value,
-			UTF32_MAX);
-	}
-	return tag_char(file, src, len, value);
+	return tag_utf_esc(file, src, len, value);
 }
 
 static bool is_dec_esc(const char *src)
@@ -475,7 +681,7 @@ static bool is_char_esc(const char *src)
 	return src[0] == '\\';
 }
 
-static unsigned get_esc_char(char c)
+static unsigned get_esc_char(uint8_t c)
 {
 	switch (c) {
 	case 'a':
@@ -508,7 +714,7 @@ Weft_ParseToken parse_char_esc(Weft_ParseFile *file, const char *src)
 		                   len_of("\\"),
 		                   "Expected character escape literal after '\\'");
 	}
-	return tag_char(file, src, len + 1, get_esc_char(src[len]));
+	return tag_char(file, src, len + 1, get_esc_char((uint8_t)src[len]));
 }
 
 Weft_ParseToken parse_char_bare(Weft_ParseFile *file, const char *src)
@@ -527,7 +733,7 @@ Weft_ParseToken parse_char_bare(Weft_ParseFile *file, const char *src)
 		}
 		return parse_char_esc(file, src);
 	}
-	return tag_char(file, src, 1, src[0]);
+	return tag_char(file, src, 1, (uint8_t)src[0]);
 }
 
 static bool is_char(const char *src)
@@ -562,7 +768,7 @@ static bool is_str(const char *src)
 	return src[0] == '"';
 }
 
-static void push_utf8(Weft_Buf **buf_p, uint32_t c)
+static size_t put_utf8(char *dest, uint32_t c)
 {
 	const uint8_t UTF8_XBYTE = 128;
 	const uint8_t UTF8_2BYTE = 192;
@@ -575,58 +781,93 @@ static void push_utf8(Weft_Buf **buf_p, uint32_t c)
 	const uint32_t UTF8_3MAX = 65535;
 	const unsigned UTF8_SHIFT = 6;
 
-	uint8_t utf8[4];
+	if (!utf8_is_scalar(c)) {
+		c = WEFT_UTF8_REPLACEMENT;
+	}
+
+	uint8_t *utf8 = (uint8_t *)dest;
 	if (c > UTF8_3MAX) {
 		utf8[0] = (uint8_t)(c >> (3 * UTF8_SHIFT)) | UTF8_4BYTE;
 		utf8[1] = (uint8_t)((c >> (2 * UTF8_SHIFT)) & ~UTF8_XMASK) | UTF8_XBYTE;
 		utf8[2] = (uint8_t)((c >> UTF8_SHIFT) & ~UTF8_XMASK) | UTF8_XBYTE;
 		utf8[3] = (uint8_t)(c & ~UTF8_XMASK) | UTF8_XBYTE;
-		buf_push(buf_p, utf8, 4);
+		return 4;
 	} else if (c > UTF8_2MAX) {
 		utf8[0] = (uint8_t)(c >> (2 * UTF8_SHIFT)) | UTF8_3BYTE;
 		utf8[1] = (uint8_t)((c >> UTF8_SHIFT) & ~UTF8_XMASK) | UTF8_XBYTE;
 		utf8[2] = (uint8_t)(c & ~UTF8_XMASK) | UTF8_XBYTE;
-		buf_push(buf_p, utf8, 3);
+		return 3;
 	} else if (c > UTF8_1MAX) {
 		utf8[0] = (uint8_t)(c >> UTF8_SHIFT) | UTF8_2BYTE;
 		utf8[1] = (uint8_t)(c & ~UTF8_XMASK) | UTF8_XBYTE;
-		buf_push(buf_p, utf8, 2);
-	} else {
-		utf8[0] = c;
-		buf_push(buf_p, utf8, 1);
+		return 2;
 	}
+	utf8[0] = c;
+	return 1;
 }
 
-static void push_char(Weft_Buf **buf_p, uint32_t cnum)
+// A '\u' or '\U' escape is always encoded as UTF-8. Any other escape
+// names a single byte, which is written as is.
+static size_t put_char(char *dest, const char *src, uint32_t cnum)
 {
-	if (cnum > UCHAR_MAX) {
-		return push_utf8(buf_p, cnum);
+	if (is_lower_utf_esc(src) || is_upper_utf_esc(src)) {
+		return put_utf8(dest, cnum);
 	}
 
-	uint8_t c = cnum;
-	buf_push(buf_p, &c, sizeof(uint8_t));
+	*dest = cnum;
+	return 1;
 }
 
+// A backslash always escapes the byte after it, so the end is found
+// without decoding the escapes.
+static size_t find_str_end(const char *src, size_t len)
+{
+	while (src[len] == '\\') {
+		len += src[len + 1] ? 2 : 1;
+		len += lex_find_str_stop(src + len);
+	}
+	return len;
+}
+
+// No escape decodes to more bytes than it takes in the source: an escaped
+// non-ASCII byte is copied through as is, and a '\u' or '\U' value never
+// needs more bytes than its digits. So the string is allocated once at the
+// size of the literal and shrunk after decoding. Runs without escapes are
+// copied whole.
 Weft_ParseToken parse_str(Weft_ParseFile *file, const char *src)
 {
-	Weft_Buf *buf = new_buf(1);
 	size_t len = len_of("\"");
-	while (src[len] != '"') {
-		if (!src[len]) {
-			return parse_error(
-				file, src, len, "Missing terminating \" character");
+	size_t run = lex_find_str_stop(src + len);
+	size_t end = find_str_end(src, len + run);
+	if (!src[end]) {
+		return parse_error(file, src, end, "Missing terminating \" character");
+	}
+
+	size_t cap = sizeof(Weft_Str) + end - len + 1;
+	Weft_Str *str = arena_alloc(file->arena, cap);
+	char *dest = str->ch;
+	while (true) {
+		memcpy(dest, src + len, run);
+		dest += run;
+		len += run;
+		if (len >= end) {
+			break;
 		}
 
 		Weft_ParseToken ch = parse_char_bare(file, src + len);
 		if (ch.type == WEFT_PARSE_CHAR) {
-			push_char(&buf, ch.cnum);
+			dest += put_char(dest, src + len, ch.cnum);
 		}
-		len += ch.len;
+		len += ch.len < end - len ? ch.len : end - len;
+		run = lex_find_str_stop(src + len);
 	}
-	len += len_of("\"");
-
-	Weft_Str *str = new_str_from_n(buf_get_raw(buf), buf_get_at(buf));
-	free(buf);
+	*dest = '\0';
+	str->len = dest - str->ch;
+	str->hash = 0;
+	str->sym = 0;
+	str = arena_realloc(
+		file->arena, str, cap, sizeof(Weft_Str) + str->len + 1);
+	len = end + len_of("\"");
 
 	return tag_str(file, src, len, str);
 }
@@ -645,75 +886,32 @@ static bool is_num(const char *src)
 
 static bool is_delim(const char *src)
 {
-	return !*src || isspace(*src) || strchr(delim_list, *src);
+	return lex_is(*src, WEFT_LEX_DELIM);
 }
 
 static size_t find_token_end(const char *src, size_t len)
 {
-	while (!is_delim(src + len)) {
-		len++;
-	}
-	return len;
+	return len + lex_find_delim(src + len);
 }
 
 Weft_ParseToken parse_num(Weft_ParseFile *file, const char *src)
 {
-	long left = 0;
-	long right = 0;
-	unsigned place = 0;
-	bool negative = false;
-	bool dot = false;
-	size_t len = 0;
-
-	if (src[len] == '-') {
-		negative = true;
-		len++;
-	}
-
-	while (src[len] == '.' || isdigit(src[len])) {
-		if (src[len] == '.') {
-			if (dot) {
-				len = find_token_end(src, len);
-				return parse_error(file, src, len, "Invalid number literal");
-			}
-			dot = true;
-		} else if (dot) {
-			right = push_digit(right, src[len]);
-			place++;
-		} else {
-			left = push_digit(left, src[len]);
-		}
-	}
-
-	if (!is_delim(src + len)) {
+	double num;
+	size_t len = num_scan(src, &num);
+	if (!len || !is_delim(src + len)) {
 		len = find_token_end(src, len);
 		return parse_error(file, src, len, "Invalid number literal");
 	}
-
-	double num = (double)right;
-	while (place) {
-		num /= 10.0;
-		place--;
-	}
-	num += (double)left;
-
-	if (negative) {
-		num = -num;
-	}
 	return tag_num(file, src, len, num);
 }
 
 Weft_ParseToken parse_word(Weft_ParseFile *file, const char *src)
 {
-	size_t len = 0;
-	while (!is_delim(src + len)) {
-		if (strchr(restricted_char_list, src[len])) {
-			char c = src[len];
-			len = find_token_end(src, len);
-			return parse_error(
-				file, src, len, "Invalid char '%c' in identifier", c);
-		}
-		len++;
+	size_t len = lex_find_word_end(src);
+	if (!is_delim(src + len)) {
+		char c = src[len];
+		len = find_token_end(src, len);
+		return parse_error(file, src, len, "Invalid char '%c' in identifier", c);
 	}
 	return tag_word(file, src, len);
 }
@@ -737,7 +935,7 @@ static bool is_close_paren(const char *src)
 Weft_ParseToken parse_close_paren(Weft_ParseFile *file, const char *src)
 {
 	return new_parse_token_with_type(
-		file, src, len_of(")"), WEFT_PARSE_OPEN_PAREN);
+		file, src, len_of(")"), WEFT_PARSE_CLOSE_PAREN);
 }
 
 static bool is_open_include(const char *src)
@@ -748,7 +946,7 @@ static bool is_open_include(const char *src)
 Weft_ParseToken parse_open_include(Weft_ParseFile *file, const char *src)
 {
 	const char *error_msg = "Expected '(' after '@'";
-	if (!src[len_of("@")] || isspace(src[len_of("@")])) {
+	if (!src[len_of("@")] || lex_is(src[len_of("@")], WEFT_LEX_SPACE)) {
 		return parse_error(file, src, len_of("@"), error_msg);
 	} else if (src[len_of("@")] != '(') {
 		return parse_error(file, src, len_of("@") + 1, error_msg);
@@ -806,7 +1004,7 @@ Weft_ParseToken parse_include(Weft_ParseFile *file, const char *src)
 		return parse_error(
 			file, src, len, "Excess information in include statement");
 	}
-	len += token.len;
+	len += len_of(")");
 
 	return tag_include(file, src, len, path);
 }
@@ -848,48 +1046,18 @@ static size_t find_shuffle_member_end(const char *src, size_t len)
 
 Weft_ParseToken parse_shuffle_member(Weft_ParseFile *file, const char *src)
 {
-	size_t len = 0;
-	while (!is_delim(src + len) && !is_shuffle_pivot(src + len)) {
-		if (strchr(restricted_char_list, src[len])) {
-			char c = src[len];
-			len = find_shuffle_member_end(src, len);
-			return parse_error(
-				file, src, len, "Invalid char '%c' in identifier", c);
-		}
+	size_t len = lex_find_member_end(src);
+	while (lex_is(src[len], WEFT_LEX_PIVOT) && !is_shuffle_pivot(src + len)) {
 		len++;
+		len += lex_find_member_end(src + len);
 	}
-	return tag_word(file, src, len);
-}
-
-Weft_ParseToken parse_shuffle(Weft_ParseFile *file, const char *src)
-{
-	Weft_ParseToken token = parse_open_shuffle(file, src);
-	size_t len = token.len;
-
-	token = parse_empty(file, src + len);
-	len += token.len;
 
-	Weft_Buf *in = new_buf(sizeof(Weft_Str *));
-	Weft_Buf *out = new_buf(sizeof(uint8_t));
-	bool pivot = false;
-
-	while (!is_close_shuffle(src + len)) {
-		if (is_shuffle_pivot(src + len)) {
-			pivot = true;
-			len += len_of("--");
-		} else if (pivot) {
-
-		} else {
-			Weft_ParseToken token = parse_shuffle_member(file, src);
-			if (token.type != WEFT_PARSE_ERROR) {
-				Weft_Str *word = new_str_from_n(token.src, token.len);
-				buf_push(&in, &word, sizeof(Weft_Str *));
-			}
-		}
+	if (lex_is(src[len], WEFT_LEX_RESTRICTED)) {
+		char c = src[len];
+		len = find_shuffle_member_end(src, len);
+		return parse_error(file, src, len, "Invalid char '%c' in identifier", c);
 	}
-
-	token = parse_close_shuffle(file, src + len);
-	len += token.len;
+	return tag_word(file, src, len);
 }
 
 static bool is_open_list(const char *src)
@@ -913,3 +1081,32 @@ Weft_ParseToken parse_close_list(Weft_ParseFile *file, const char *src)
 	return new_parse_token_with_type(
 		file, src, len_of("]"), WEFT_PARSE_CLOSE_LIST);
 }
+
+// Shuffles are returned as their brackets and members.
+Weft_ParseToken parse_token(Weft_ParseFile *file, const char *src)
+{
+	if (is_str(src)) {
+		return parse_str(file, src);
+	} else if (is_char(src)) {
+		return parse_char(file, src);
+	} else if (is_open_include(src)) {
+		return parse_include(file, src);
+	} else if (is_open_paren(src)) {
+		return parse_open_paren(file, src);
+	} else if (is_close_paren(src)) {
+		return parse_close_paren(file, src);
+	} else if (is_open_shuffle(src)) {
+		return parse_open_shuffle(file, src);
+	} else if (is_close_shuffle(src)) {
+		return parse_close_shuffle(file, src);
+	} else if (is_open_list(src)) {
+		return parse_open_list(file, src);
+	} else if (is_close_list(src)) {
+		return parse_close_list(file, src);
+	} else if (is_num(src)) {
+		return parse_num(file, src);
+	} else if (is_delim(src)) {
+		return parse_error(file, src, 1, "Unexpected char '%c'", *src);
+	}
+	return parse_word(file, src);
+}
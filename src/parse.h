@@ -1,21 +1,41 @@
 #ifndef WEFT_PARSE_H
 #define WEFT_PARSE_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
 // Forward Declarations
 
+typedef struct weft_arena Weft_Arena;
+typedef struct weft_buf Weft_Buf;
 typedef struct weft_str Weft_Str;
 typedef struct weft_parse_file Weft_ParseFile;
+typedef struct weft_parse_pos Weft_ParsePos;
 typedef enum weft_parse_type Weft_ParseType;
 typedef struct weft_parse_token Weft_ParseToken;
 
 // Data Types
 
+// Lines and columns are zero-based byte offsets.
+struct weft_parse_pos {
+	size_t line;
+	size_t col;
+};
+
+// A file loaded with load_parse_file maps its source read-only instead of
+// holding a GC copy, and map_span is the size of that mapping. A streamed
+// file only holds a window of its input, which starts at base.
 struct weft_parse_file {
 	char *path;
 	char *src;
+	size_t map_span;
+	bool is_streamed;
+	Weft_ParsePos base;
+	Weft_Arena *arena;
+	Weft_Buf *lines;
+	Weft_Buf *syms;
+	Weft_Buf *sym_seen;
 };
 
 enum weft_parse_type {
@@ -51,13 +71,20 @@ struct weft_parse_token {
 // Functions
 
 Weft_ParseFile *new_parse_file(char *path, char *src);
+Weft_ParseFile *load_parse_file(const char *path);
 void parse_file_mark(Weft_ParseFile *file);
+void parse_file_release(Weft_ParseFile *file);
+size_t parse_file_get_line_count(Weft_ParseFile *file);
+const char *parse_file_get_line(Weft_ParseFile *file, size_t line);
+Weft_ParsePos parse_file_get_pos(Weft_ParseFile *file, const char *at);
 Weft_ParseToken
 new_parse_token(Weft_ParseFile *file, const char *src, size_t len);
 void parse_token_mark(Weft_ParseToken token);
+Weft_ParseToken parse_token_promote(Weft_ParseToken token);
 Weft_ParseToken parse_error(
 	Weft_ParseFile *file, const char *src, size_t len, const char *fmt, ...);
 Weft_ParseToken parse_line_comment(Weft_ParseFile *file, const char *src);
 Weft_ParseToken parse_empty(Weft_ParseFile *file, const char *src);
+Weft_ParseToken parse_token(Weft_ParseFile *file, const char *src);
 
 #endif
@@ -0,0 +1,895 @@
+#include "slab.h"
+
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Constants
+
+static const size_t LINEAR_STEP = 16;
+static const size_t LINEAR_COUNT = 8;
+static const unsigned LINEAR_SHIFT = 7;
+static const unsigned STEPS_PER_DOUBLING = 4;
+
+// Globals
+
+static Weft_SlabClass g_class[WEFT_SLAB_TYPE_COUNT][WEFT_SLAB_CLASS_COUNT];
+static Weft_Slab *g_large;
+static Weft_Slab *g_nursery;
+static Weft_Slab *g_sweep;
+static Weft_Slab *g_evacuated;
+static Weft_SlabFinalizeFn g_finalize[WEFT_SLAB_TYPE_COUNT];
+static bool g_keep_marks = false;
+static uint32_t g_pin_epoch = 1;
+static size_t g_slab_count = 0;
+static size_t g_used_count = 0;
+static size_t g_used_bytes = 0;
+static size_t g_freed_count = 0;
+static size_t g_freed_bytes = 0;
+static size_t g_mapped_bytes = 0;
+static size_t g_peak_mapped_bytes = 0;
+
+// Functions
+
+Weft_Slab *slab_of(const void *ptr)
+{
+	return (Weft_Slab *)((uintptr_t)ptr & ~(uintptr_t)(WEFT_SLAB_SIZE - 1));
+}
+
+static unsigned floor_log2(size_t n)
+{
+	return 8 * sizeof(unsigned long) - 1 - __builtin_clzl(n);
+}
+
+size_t slab_get_class(size_t size)
+{
+	if (size <= LINEAR_STEP) {
+		return 0;
+	} else if (size <= LINEAR_COUNT * LINEAR_STEP) {
+		return (size - 1) / LINEAR_STEP;
+	}
+
+	unsigned shift = floor_log2(size - 1);
+	size_t step = (size - 1) >> (shift - 2);
+	return LINEAR_COUNT + (shift - LINEAR_SHIFT) * STEPS_PER_DOUBLING + step
+	     - STEPS_PER_DOUBLING;
+}
+
+size_t slab_get_class_size(size_t class)
+{
+	if (class < LINEAR_COUNT) {
+		return (class + 1) * LINEAR_STEP;
+	}
+
+	class -= LINEAR_COUNT;
+	unsigned shift = LINEAR_SHIFT + class / STEPS_PER_DOUBLING;
+	size_t step = STEPS_PER_DOUBLING + class % STEPS_PER_DOUBLING + 1;
+	return step << (shift - 2);
+}
+
+size_t slab_get_count(void)
+{
+	return g_slab_count;
+}
+
+size_t slab_get_used_count(void)
+{
+	return g_used_count;
+}
+
+size_t slab_get_used_bytes(void)
+{
+	return g_used_bytes;
+}
+
+size_t slab_get_freed_count(void)
+{
+	return g_freed_count;
+}
+
+size_t slab_get_freed_bytes(void)
+{
+	return g_freed_bytes;
+}
+
+size_t slab_get_mapped_bytes(void)
+{
+	return g_mapped_bytes;
+}
+
+size_t slab_get_peak_mapped_bytes(void)
+{
+	return g_peak_mapped_bytes;
+}
+
+size_t slab_get_size(const void *ptr)
+{
+	return slab_of(ptr)->cell_size;
+}
+
+uint32_t slab_get_type(const void *ptr)
+{
+	return slab_of(ptr)->type;
+}
+
+static size_t round_up(size_t size, size_t align)
+{
+	return (size + align - 1) & ~(align - 1);
+}
+
+static void *map_aligned(size_t span)
+{
+	size_t raw_span = span + WEFT_SLAB_SIZE;
+	char *raw = mmap(NULL,
+	                 raw_span,
+	                 PROT_READ | PROT_WRITE,
+	                 MAP_PRIVATE | MAP_ANONYMOUS,
+	                 -1,
+	                 0);
+	if (raw == MAP_FAILED) {
+		return NULL;
+	}
+
+	char *start = (char *)round_up((uintptr_t)raw, WEFT_SLAB_SIZE);
+	char *end = start + span;
+	if (start > raw) {
+		munmap(raw, start - raw);
+	}
+	if (raw + raw_span > end) {
+		munmap(end, raw + raw_span - end);
+	}
+	return start;
+}
+
+static Weft_Slab *
+new_slab(uint32_t type, uint32_t class, size_t cell_size, size_t span)
+{
+	Weft_Slab *slab = map_aligned(span);
+	if (!slab) {
+		return NULL;
+	}
+
+	slab->prev = NULL;
+	slab->next = NULL;
+	slab->prev_avail = NULL;
+	slab->next_avail = NULL;
+	slab->next_nursery = NULL;
+	slab->next_sweep = NULL;
+	slab->next_evacuated = NULL;
+	slab->span = span;
+	slab->type = type;
+	slab->class = class;
+	slab->cell_size = cell_size;
+	// A large slab holds a single cell, whose size may not fit in 32 bits,
+	// so its cell index is always 0.
+	if (class == WEFT_SLAB_LARGE) {
+		slab->cell_count = 1;
+		slab->cell_magic = 0;
+	} else {
+		slab->cell_count = (span - sizeof(Weft_Slab)) / cell_size;
+		slab->cell_magic = UINT32_MAX / cell_size + 1;
+	}
+	slab->cursor = 0;
+	slab->bump = 0;
+	slab->used = 0;
+	slab->owned_used = 0;
+	slab->pin_epoch = 0;
+	slab->is_avail = false;
+	slab->is_nursery = false;
+	slab->is_unswept = false;
+	slab->is_owned = false;
+	slab->is_evacuated = false;
+	g_slab_count++;
+	g_mapped_bytes += span;
+	if (g_mapped_bytes > g_peak_mapped_bytes) {
+		g_peak_mapped_bytes = g_mapped_bytes;
+	}
+
+	return slab;
+}
+
+static void delete_slab(Weft_Slab *slab)
+{
+	g_slab_count--;
+	g_mapped_bytes -= slab->span;
+	munmap(slab, slab->span);
+}
+
+static void link_slab(Weft_Slab **head_p, Weft_Slab *slab)
+{
+	slab->prev = NULL;
+	slab->next = *head_p;
+	if (*head_p) {
+		(*head_p)->prev = slab;
+	}
+	*head_p = slab;
+}
+
+static void unlink_slab(Weft_Slab **head_p, Weft_Slab *slab)
+{
+	if (slab->prev) {
+		slab->prev->next = slab->next;
+	} else {
+		*head_p = slab->next;
+	}
+
+	if (slab->next) {
+		slab->next->prev = slab->prev;
+	}
+}
+
+static size_t get_bitmap_words(const Weft_Slab *slab)
+{
+	return (slab->cell_count + 63) / 64;
+}
+
+static size_t get_cell_index(const Weft_Slab *slab, const void *ptr)
+{
+	uint64_t offset = (const char *)ptr - slab->raw;
+	return (offset * slab->cell_magic) >> 32;
+}
+
+static bool test_bit(const uint64_t *bitmap, size_t index)
+{
+	return (bitmap[index / 64] >> (index % 64)) & 1;
+}
+
+static void set_bit(uint64_t *bitmap, size_t index)
+{
+	bitmap[index / 64] |= (uint64_t)1 << (index % 64);
+}
+
+static void clear_bit(uint64_t *bitmap, size_t index)
+{
+	bitmap[index / 64] &= ~((uint64_t)1 << (index % 64));
+}
+
+static bool is_slab_full(const Weft_Slab *slab)
+{
+	return slab->used == slab->cell_count;
+}
+
+static Weft_SlabClass *get_slab_class(const Weft_Slab *slab)
+{
+	return &g_class[slab->type][slab->class];
+}
+
+static void link_avail(Weft_SlabClass *class, Weft_Slab *slab)
+{
+	slab->prev_avail = NULL;
+	slab->next_avail = class->avail;
+	if (class->avail) {
+		class->avail->prev_avail = slab;
+	}
+	class->avail = slab;
+	slab->is_avail = true;
+}
+
+static void unlink_avail(Weft_SlabClass *class, Weft_Slab *slab)
+{
+	if (slab->prev_avail) {
+		slab->prev_avail->next_avail = slab->next_avail;
+	} else {
+		class->avail = slab->next_avail;
+	}
+
+	if (slab->next_avail) {
+		slab->next_avail->prev_avail = slab->prev_avail;
+	}
+	slab->prev_avail = NULL;
+	slab->next_avail = NULL;
+	slab->is_avail = false;
+}
+
+static void push_nursery(Weft_Slab *slab)
+{
+	slab->next_nursery = g_nursery;
+	g_nursery = slab;
+	slab->is_nursery = true;
+}
+
+static Weft_Slab *pop_nursery(void)
+{
+	Weft_Slab *slab = g_nursery;
+	g_nursery = slab->next_nursery;
+	slab->next_nursery = NULL;
+	slab->is_nursery = false;
+
+	return slab;
+}
+
+static void push_sweep(Weft_Slab *slab)
+{
+	slab->next_sweep = g_sweep;
+	g_sweep = slab;
+	slab->is_unswept = true;
+}
+
+static Weft_Slab *pop_sweep(void)
+{
+	Weft_Slab *slab = g_sweep;
+	g_sweep = slab->next_sweep;
+	slab->next_sweep = NULL;
+
+	return slab;
+}
+
+static size_t find_bump(const Weft_Slab *slab)
+{
+	for (size_t i = get_bitmap_words(slab); i > 0; i--) {
+		if (slab->alloc[i - 1]) {
+			return 64 * i - __builtin_clzll(slab->alloc[i - 1]);
+		}
+	}
+	return 0;
+}
+
+static void clear_marks(Weft_Slab *slab)
+{
+	memset(slab->mark, 0, get_bitmap_words(slab) * sizeof(uint64_t));
+}
+
+static void finalize_dead(Weft_Slab *slab)
+{
+	Weft_SlabFinalizeFn finalize = g_finalize[slab->type];
+	for (size_t i = 0; i < get_bitmap_words(slab); i++) {
+		uint64_t dead = slab->alloc[i] & ~slab->mark[i];
+		for (; dead; dead &= dead - 1) {
+			finalize(slab->raw + (64 * i + __builtin_ctzll(dead))
+			                       * slab->cell_size);
+		}
+	}
+}
+
+static void sweep_slab(Weft_Slab *slab)
+{
+	if (!slab->is_unswept) {
+		return;
+	}
+	slab->is_unswept = false;
+	if (g_finalize[slab->type]) {
+		finalize_dead(slab);
+	}
+
+	size_t words = get_bitmap_words(slab);
+	size_t freed = 0;
+	for (size_t i = 0; i < words; i++) {
+		freed += __builtin_popcountll(slab->alloc[i] & ~slab->mark[i]);
+	}
+
+	memcpy(slab->alloc, slab->mark, words * sizeof(uint64_t));
+	if (!g_keep_marks) {
+		clear_marks(slab);
+	}
+	slab->cursor = 0;
+	slab->used -= freed;
+	slab->bump = find_bump(slab);
+	g_used_count -= freed;
+	g_used_bytes -= freed * slab->cell_size;
+	g_freed_count += freed;
+	g_freed_bytes += freed * slab->cell_size;
+}
+
+static void release_large(Weft_Slab *slab)
+{
+	if (!slab->used) {
+		unlink_slab(&g_large, slab);
+		delete_slab(slab);
+	}
+}
+
+static void release_slab(Weft_Slab *slab)
+{
+	Weft_SlabClass *class = get_slab_class(slab);
+	if (!slab->used && class->slab_count > 1) {
+		if (slab->is_avail) {
+			unlink_avail(class, slab);
+		}
+		unlink_slab(&class->slabs, slab);
+		class->slab_count--;
+		delete_slab(slab);
+	} else if (!slab->is_avail && !is_slab_full(slab)) {
+		link_avail(class, slab);
+	}
+}
+
+static Weft_Slab *get_avail(Weft_SlabClass *class)
+{
+	Weft_Slab *slab = class->avail;
+	while (slab && slab->is_unswept) {
+		sweep_slab(slab);
+		if (!is_slab_full(slab)) {
+			break;
+		}
+		unlink_avail(class, slab);
+		slab = class->avail;
+	}
+	return slab;
+}
+
+static size_t find_cell(Weft_Slab *slab)
+{
+	if (slab->used == slab->bump) {
+		return slab->bump++;
+	}
+
+	while (slab->alloc[slab->cursor] == UINT64_MAX) {
+		slab->cursor++;
+	}
+	return 64 * slab->cursor + __builtin_ctzll(~slab->alloc[slab->cursor]);
+}
+
+static void *pop_cell(Weft_Slab *slab)
+{
+	size_t index = find_cell(slab);
+	set_bit(slab->alloc, index);
+	slab->used++;
+	g_used_count++;
+	g_used_bytes += slab->cell_size;
+
+	if (!slab->is_nursery) {
+		push_nursery(slab);
+	}
+	return slab->raw + index * slab->cell_size;
+}
+
+static void *alloc_large(uint32_t type, size_t size)
+{
+	if (size > SIZE_MAX - sizeof(Weft_Slab) - WEFT_SLAB_SIZE) {
+		return NULL;
+	}
+
+	size_t span = round_up(sizeof(Weft_Slab) + size, getpagesize());
+	Weft_Slab *slab =
+		new_slab(type, WEFT_SLAB_LARGE, span - sizeof(Weft_Slab), span);
+	if (!slab) {
+		return NULL;
+	}
+
+	link_slab(&g_large, slab);
+	return pop_cell(slab);
+}
+
+static Weft_Slab *find_slab(uint32_t type, size_t class_index)
+{
+	Weft_SlabClass *class = &g_class[type][class_index];
+	Weft_Slab *slab = get_avail(class);
+	for (size_t i = 0; !slab && i < WEFT_SLAB_LAZY_SWEEP; i++) {
+		if (!slab_sweep_next()) {
+			break;
+		}
+		slab = get_avail(class);
+	}
+
+	if (!slab) {
+		slab = new_slab(type,
+		                class_index,
+		                slab_get_class_size(class_index),
+		                WEFT_SLAB_SIZE);
+		if (!slab) {
+			return NULL;
+		}
+		link_slab(&class->slabs, slab);
+		link_avail(class, slab);
+		class->slab_count++;
+	}
+	return slab;
+}
+
+void slab_set_finalizer(uint32_t type, Weft_SlabFinalizeFn finalize)
+{
+	g_finalize[type] = finalize;
+}
+
+void *slab_alloc(size_t size, uint32_t type)
+{
+	if (size > WEFT_SLAB_MAX_CELL) {
+		return alloc_large(type, size);
+	}
+
+	Weft_Slab *slab = find_slab(type, slab_get_class(size));
+	if (!slab) {
+		return NULL;
+	}
+
+	void *ptr = pop_cell(slab);
+	if (is_slab_full(slab)) {
+		unlink_avail(get_slab_class(slab), slab);
+	}
+	return ptr;
+}
+
+Weft_Slab *slab_acquire(size_t size, uint32_t type)
+{
+	Weft_Slab *slab = find_slab(type, slab_get_class(size));
+	if (!slab) {
+		return NULL;
+	}
+
+	unlink_avail(get_slab_class(slab), slab);
+	slab->is_owned = true;
+	slab->owned_used = slab->used;
+	if (!slab->is_nursery) {
+		push_nursery(slab);
+	}
+	return slab;
+}
+
+void *slab_alloc_owned(Weft_Slab *slab)
+{
+	if (is_slab_full(slab)) {
+		return NULL;
+	}
+
+	size_t index = find_cell(slab);
+	set_bit(slab->alloc, index);
+	slab->used++;
+
+	return slab->raw + index * slab->cell_size;
+}
+
+size_t slab_return(Weft_Slab *slab)
+{
+	size_t count = slab->used - slab->owned_used;
+	g_used_count += count;
+	g_used_bytes += count * slab->cell_size;
+
+	slab->is_owned = false;
+	if (!is_slab_full(slab)) {
+		link_avail(get_slab_class(slab), slab);
+	}
+	return count;
+}
+
+void slab_free(void *ptr)
+{
+	Weft_Slab *slab = slab_of(ptr);
+	size_t index = get_cell_index(slab, ptr);
+	clear_bit(slab->alloc, index);
+	clear_bit(slab->mark, index);
+	slab->used--;
+	g_used_count--;
+	g_used_bytes -= slab->cell_size;
+
+	if (slab->cursor > index / 64) {
+		slab->cursor = index / 64;
+	}
+
+	if (slab->class != WEFT_SLAB_LARGE && !slab->is_avail) {
+		link_avail(get_slab_class(slab), slab);
+	}
+}
+
+bool slab_mark(const void *ptr)
+{
+	Weft_Slab *slab = slab_of(ptr);
+	size_t index = get_cell_index(slab, ptr);
+	if (test_bit(slab->mark, index)) {
+		return true;
+	}
+	set_bit(slab->mark, index);
+
+	return false;
+}
+
+bool slab_mark_atomic(const void *ptr)
+{
+	Weft_Slab *slab = slab_of(ptr);
+	size_t index = get_cell_index(slab, ptr);
+	uint64_t bit = (uint64_t)1 << (index % 64);
+	uint64_t *word = &slab->mark[index / 64];
+	if (__atomic_load_n(word, __ATOMIC_RELAXED) & bit) {
+		return true;
+	}
+	return __atomic_fetch_or(word, bit, __ATOMIC_RELAXED) & bit;
+}
+
+bool slab_is_marked(const void *ptr)
+{
+	Weft_Slab *slab = slab_of(ptr);
+	return test_bit(slab->mark, get_cell_index(slab, ptr));
+}
+
+bool slab_remember(const void *ptr)
+{
+	Weft_Slab *slab = slab_of(ptr);
+	size_t index = get_cell_index(slab, ptr);
+	if (test_bit(slab->remember, index)) {
+		return true;
+	}
+	set_bit(slab->remember, index);
+
+	return false;
+}
+
+void slab_forget(const void *ptr)
+{
+	Weft_Slab *slab = slab_of(ptr);
+	clear_bit(slab->remember, get_cell_index(slab, ptr));
+}
+
+static void begin_sweep_all(void)
+{
+	while (g_nursery) {
+		pop_nursery();
+	}
+
+	for (size_t type = 0; type < WEFT_SLAB_TYPE_COUNT; type++) {
+		for (size_t class = 0; class < WEFT_SLAB_CLASS_COUNT; class++) {
+			Weft_Slab *slab = g_class[type][class].slabs;
+			for (; slab; slab = slab->next) {
+				push_sweep(slab);
+			}
+		}
+	}
+
+	for (Weft_Slab *slab = g_large; slab; slab = slab->next) {
+		push_sweep(slab);
+	}
+}
+
+static void begin_sweep_nursery(void)
+{
+	while (g_nursery) {
+		push_sweep(pop_nursery());
+	}
+}
+
+void slab_begin_sweep(bool is_full, bool keep_marks)
+{
+	g_keep_marks = keep_marks;
+	if (is_full) {
+		begin_sweep_all();
+	} else {
+		begin_sweep_nursery();
+	}
+}
+
+bool slab_is_sweeping(void)
+{
+	return g_sweep;
+}
+
+bool slab_sweep_next(void)
+{
+	if (!g_sweep) {
+		return false;
+	}
+
+	Weft_Slab *slab = pop_sweep();
+	if (!slab->is_unswept) {
+		return true;
+	}
+
+	sweep_slab(slab);
+	if (slab->class == WEFT_SLAB_LARGE) {
+		release_large(slab);
+	} else {
+		release_slab(slab);
+	}
+	return true;
+}
+
+static size_t count_marks(const Weft_Slab *slab)
+{
+	size_t count = 0;
+	for (size_t i = 0; i < get_bitmap_words(slab); i++) {
+		count += __builtin_popcountll(slab->mark[i]);
+	}
+	return count;
+}
+
+double slab_get_fragmentation(void)
+{
+	size_t live_bytes = 0;
+	size_t capacity = 0;
+	for (size_t type = 0; type < WEFT_SLAB_TYPE_COUNT; type++) {
+		for (size_t class = 0; class < WEFT_SLAB_CLASS_COUNT; class++) {
+			Weft_Slab *slab = g_class[type][class].slabs;
+			for (; slab; slab = slab->next) {
+				live_bytes += count_marks(slab) * slab->cell_size;
+				capacity += slab->cell_count * slab->cell_size;
+			}
+		}
+	}
+
+	if (!capacity) {
+		return 0.0;
+	}
+	return 1.0 - (double)live_bytes / (double)capacity;
+}
+
+static size_t select_evacuated(Weft_SlabClass *class, double max_occupancy)
+{
+	Weft_Slab *slab = class->slabs;
+	if (!slab) {
+		return 0;
+	}
+
+	size_t cell_count = slab->cell_count;
+	size_t live_count = 0;
+	for (; slab; slab = slab->next) {
+		live_count += count_marks(slab);
+	}
+
+	size_t needed = (live_count + cell_count - 1) / cell_count;
+	if (needed >= class->slab_count) {
+		return 0;
+	}
+
+	size_t spare = class->slab_count - needed;
+	size_t selected = 0;
+	for (slab = class->slabs; slab && selected < spare; slab = slab->next) {
+		if (slab->pin_epoch != g_pin_epoch
+		    && count_marks(slab) <= max_occupancy * cell_count) {
+			slab->is_evacuated = true;
+			slab->next_evacuated = g_evacuated;
+			g_evacuated = slab;
+			selected++;
+		}
+	}
+	return selected;
+}
+
+static void *take_unmarked(Weft_Slab *slab)
+{
+	for (size_t i = 0; i < get_bitmap_words(slab); i++) {
+		uint64_t free = ~slab->mark[i];
+		if (!free) {
+			continue;
+		}
+
+		size_t index = 64 * i + __builtin_ctzll(free);
+		if (index >= slab->cell_count) {
+			return NULL;
+		}
+
+		char *ptr = slab->raw + index * slab->cell_size;
+		set_bit(slab->mark, index);
+		if (test_bit(slab->alloc, index)) {
+			if (g_finalize[slab->type]) {
+				g_finalize[slab->type](ptr);
+			}
+			g_freed_count++;
+			g_freed_bytes += slab->cell_size;
+		} else {
+			set_bit(slab->alloc, index);
+			slab->used++;
+			g_used_count++;
+			g_used_bytes += slab->cell_size;
+		}
+
+		if (slab->is_avail && is_slab_full(slab)) {
+			unlink_avail(get_slab_class(slab), slab);
+		}
+		return ptr;
+	}
+	return NULL;
+}
+
+static Weft_Slab *next_destination(Weft_Slab *slab)
+{
+	while (slab && slab->is_evacuated) {
+		slab = slab->next;
+	}
+	return slab;
+}
+
+static void evacuate_slab(Weft_Slab *slab, Weft_Slab **dest_p)
+{
+	for (size_t i = 0; i < get_bitmap_words(slab); i++) {
+		for (uint64_t marks = slab->mark[i]; marks; marks &= marks - 1) {
+			char *ptr = slab->raw + (64 * i + __builtin_ctzll(marks))
+			                          * slab->cell_size;
+			void *moved;
+			while (!(moved = take_unmarked(*dest_p))) {
+				*dest_p = next_destination((*dest_p)->next);
+			}
+
+			memcpy(moved, ptr, slab->cell_size);
+			*(void **)ptr = moved;
+		}
+	}
+}
+
+// A pinned slab is never evacuated, so pointers to it held outside the
+// heap stay valid. Pins last until slab_end_pins ends the cycle.
+void slab_pin(const void *ptr)
+{
+	slab_of(ptr)->pin_epoch = g_pin_epoch;
+}
+
+void slab_end_pins(void)
+{
+	g_pin_epoch++;
+}
+
+bool slab_evacuate(double max_occupancy)
+{
+	bool is_evacuated = false;
+	for (size_t type = 0; type < WEFT_SLAB_TYPE_COUNT; type++) {
+		for (size_t class = 0; class < WEFT_SLAB_CLASS_COUNT; class++) {
+			Weft_SlabClass *slab_class = &g_class[type][class];
+			if (!select_evacuated(slab_class, max_occupancy)) {
+				continue;
+			}
+
+			Weft_Slab *dest = next_destination(slab_class->slabs);
+			for (Weft_Slab *slab = g_evacuated;
+			     slab && get_slab_class(slab) == slab_class;
+			     slab = slab->next_evacuated) {
+				evacuate_slab(slab, &dest);
+			}
+			is_evacuated = true;
+		}
+	}
+	return is_evacuated;
+}
+
+bool slab_is_evacuated(const void *ptr)
+{
+	return slab_of(ptr)->is_evacuated;
+}
+
+void *slab_get_forward(const void *ptr)
+{
+	return *(void *const *)ptr;
+}
+
+static void visit_slab(Weft_Slab *slab, void (*visit)(void *ptr))
+{
+	for (size_t i = 0; i < get_bitmap_words(slab); i++) {
+		for (uint64_t marks = slab->mark[i]; marks; marks &= marks - 1) {
+			visit(slab->raw + (64 * i + __builtin_ctzll(marks))
+			                    * slab->cell_size);
+		}
+	}
+}
+
+void slab_visit_marked(uint32_t type, void (*visit)(void *ptr))
+{
+	for (size_t class = 0; class < WEFT_SLAB_CLASS_COUNT; class++) {
+		Weft_Slab *slab = g_class[type][class].slabs;
+		for (; slab; slab = slab->next) {
+			if (!slab->is_evacuated) {
+				visit_slab(slab, visit);
+			}
+		}
+	}
+
+	for (Weft_Slab *slab = g_large; slab; slab = slab->next) {
+		if (slab->type == type) {
+			visit_slab(slab, visit);
+		}
+	}
+}
+
+void slab_end_evacuate(void)
+{
+	while (g_nursery) {
+		pop_nursery();
+	}
+
+	while (g_evacuated) {
+		Weft_Slab *slab = g_evacuated;
+		g_evacuated = slab->next_evacuated;
+
+		Weft_SlabClass *class = get_slab_class(slab);
+		if (slab->is_avail) {
+			unlink_avail(class, slab);
+		}
+		unlink_slab(&class->slabs, slab);
+		class->slab_count--;
+
+		if (g_finalize[slab->type]) {
+			finalize_dead(slab);
+		}
+
+		size_t freed = slab->used - count_marks(slab);
+		g_used_count -= slab->used;
+		g_used_bytes -= slab->used * slab->cell_size;
+		g_freed_count += freed;
+		g_freed_bytes += freed * slab->cell_size;
+		delete_slab(slab);
+	}
+}
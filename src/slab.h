@@ -0,0 +1,100 @@
+#ifndef WEFT_SLAB_H
+#define WEFT_SLAB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Forward Declarations
+
+typedef struct weft_slab Weft_Slab;
+typedef struct weft_slab_class Weft_SlabClass;
+typedef void (*Weft_SlabFinalizeFn)(void *ptr);
+
+// Constants
+
+#define WEFT_SLAB_CLASS_COUNT 28
+#define WEFT_SLAB_TYPE_COUNT 16
+#define WEFT_SLAB_BITMAP_WORDS 64
+
+static const size_t WEFT_SLAB_SIZE = 65536;
+static const size_t WEFT_SLAB_MAX_CELL = 4096;
+static const size_t WEFT_SLAB_LAZY_SWEEP = 16;
+static const uint32_t WEFT_SLAB_LARGE = UINT32_MAX;
+
+// Data Types
+
+struct weft_slab {
+	Weft_Slab *prev;
+	Weft_Slab *next;
+	Weft_Slab *prev_avail;
+	Weft_Slab *next_avail;
+	Weft_Slab *next_nursery;
+	Weft_Slab *next_sweep;
+	Weft_Slab *next_evacuated;
+	size_t span;
+	size_t cell_size;
+	uint32_t type;
+	uint32_t class;
+	uint32_t cell_count;
+	uint32_t cell_magic;
+	uint32_t cursor;
+	uint32_t bump;
+	uint32_t used;
+	uint32_t owned_used;
+	uint32_t pin_epoch;
+	bool is_avail;
+	bool is_nursery;
+	bool is_unswept;
+	bool is_owned;
+	bool is_evacuated;
+	uint64_t alloc[WEFT_SLAB_BITMAP_WORDS];
+	uint64_t mark[WEFT_SLAB_BITMAP_WORDS];
+	uint64_t remember[WEFT_SLAB_BITMAP_WORDS];
+	_Alignas(16) char raw[];
+};
+
+struct weft_slab_class {
+	Weft_Slab *slabs;
+	Weft_Slab *avail;
+	size_t slab_count;
+};
+
+// Functions
+
+Weft_Slab *slab_of(const void *ptr);
+size_t slab_get_class(size_t size);
+size_t slab_get_class_size(size_t class);
+size_t slab_get_count(void);
+size_t slab_get_used_count(void);
+size_t slab_get_used_bytes(void);
+size_t slab_get_freed_count(void);
+size_t slab_get_freed_bytes(void);
+size_t slab_get_mapped_bytes(void);
+size_t slab_get_peak_mapped_bytes(void);
+size_t slab_get_size(const void *ptr);
+uint32_t slab_get_type(const void *ptr);
+void slab_set_finalizer(uint32_t type, Weft_SlabFinalizeFn finalize);
+void *slab_alloc(size_t size, uint32_t type);
+void slab_free(void *ptr);
+Weft_Slab *slab_acquire(size_t size, uint32_t type);
+void *slab_alloc_owned(Weft_Slab *slab);
+size_t slab_return(Weft_Slab *slab);
+bool slab_mark(const void *ptr);
+bool slab_mark_atomic(const void *ptr);
+bool slab_is_marked(const void *ptr);
+bool slab_remember(const void *ptr);
+void slab_forget(const void *ptr);
+void slab_begin_sweep(bool is_full, bool keep_marks);
+bool slab_is_sweeping(void);
+bool slab_sweep_next(void);
+double slab_get_fragmentation(void);
+void slab_pin(const void *ptr);
+void slab_end_pins(void);
+bool slab_evacuate(double max_occupancy);
+bool slab_is_evacuated(const void *ptr);
+void *slab_get_forward(const void *ptr);
+void slab_visit_marked(uint32_t type, void (*visit)(void *ptr));
+void slab_end_evacuate(void);
+
+#endif
@@ -1,13 +1,360 @@
 #include "str.h"
+#include "arena.h"
+#include "buf.h"
 #include "gc.h"
+#include "lex.h"
+#include "utf8.h"
 
 #include <string.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#define WEFT_STR_HAS_X86 1
+#include <immintrin.h>
+#else
+#define WEFT_STR_HAS_X86 0
+#endif
+
+// Allocates a string of len bytes to be filled in place, which saves the
+// copy through a temporary that new_str_from_n would need.
+Weft_Str *new_str(size_t len)
+{
+	Weft_Str *str = gc_alloc(sizeof(Weft_Str) + len + 1);
+	str->len = len;
+	str->hash = 0;
+	str->sym = 0;
+	str->ch[len] = 0;
+
+	return str;
+}
+
 Weft_Str *new_str_from_n(const char *src, size_t len)
 {
-	Weft_Str *str = gc_alloc(len + 1);
+	Weft_Str *str = new_str(len);
+	memcpy(str->ch, src, len);
+
+	return str;
+}
+
+Weft_Str *
+new_arena_str_from_n(Weft_Arena *arena, const char *src, size_t len)
+{
+	Weft_Str *str = arena_alloc(arena, sizeof(Weft_Str) + len + 1);
+	str->len = len;
+	str->hash = 0;
+	str->sym = 0;
 	memcpy(str->ch, src, len);
 	str->ch[len] = 0;
 
 	return str;
 }
+
+Weft_Str *str_promote(const Weft_Str *str)
+{
+	return new_str_from_n(str->ch, str->len);
+}
+
+bool str_is_utf8(const Weft_Str *str)
+{
+	return utf8_is_valid(str->ch, str->len);
+}
+
+// Folds eight bytes at a time with a multiply and xor-shift, then mixes
+// the length into the final avalanche.
+uint32_t str_hash(const char *src, size_t len)
+{
+	const uint64_t MUL = 0x9e3779b97f4a7c15;
+	uint64_t hash = len * MUL;
+	size_t at = 0;
+	for (; at + sizeof(uint64_t) <= len; at += sizeof(uint64_t)) {
+		uint64_t word;
+		memcpy(&word, src + at, sizeof(uint64_t));
+		hash = (hash ^ word) * MUL;
+		hash ^= hash >> 29;
+	}
+
+	if (at < len) {
+		uint64_t word = 0;
+		memcpy(&word, src + at, len - at);
+		hash = (hash ^ word) * MUL;
+	}
+
+	hash ^= hash >> 32;
+	hash *= MUL;
+	hash ^= hash >> 29;
+	return (uint32_t)hash ? (uint32_t)hash : 1;
+}
+
+uint32_t str_get_hash(Weft_Str *str)
+{
+	if (!str->hash) {
+		str->hash = str_hash(str->ch, str->len);
+	}
+	return str->hash;
+}
+
+static size_t find_mismatch_scalar(const char *a, const char *b, size_t len)
+{
+	size_t at = 0;
+	while (at < len && a[at] == b[at]) {
+		at++;
+	}
+	return at;
+}
+
+// A needle is only compared in full where its first and last bytes both
+// match, which the vector versions test for a whole block at once.
+static size_t find_scalar(const char *src,
+                          size_t src_len,
+                          const char *needle,
+                          size_t len,
+                          size_t at)
+{
+	for (; at + len <= src_len; at++) {
+		if (src[at] == needle[0] && src[at + len - 1] == needle[len - 1]
+		    && !memcmp(src + at + 1, needle + 1, len - 2)) {
+			return at;
+		}
+	}
+	return WEFT_STR_NOT_FOUND;
+}
+
+#if WEFT_STR_HAS_X86
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+
+SSE2 static size_t find_mismatch_sse2(const char *a, const char *b, size_t len)
+{
+	size_t at = 0;
+	for (; at + 16 <= len; at += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(a + at));
+		__m128i y = _mm_loadu_si128((const __m128i *)(b + at));
+		uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) ^ 0xffff;
+		if (mask) {
+			return at + __builtin_ctz(mask);
+		}
+	}
+	return at + find_mismatch_scalar(a + at, b + at, len - at);
+}
+
+AVX2 static size_t find_mismatch_avx2(const char *a, const char *b, size_t len)
+{
+	size_t at = 0;
+	for (; at + 32 <= len; at += 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(a + at));
+		__m256i y = _mm256_loadu_si256((const __m256i *)(b + at));
+		uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+		mask = ~mask;
+		if (mask) {
+			return at + __builtin_ctz(mask);
+		}
+	}
+	return at + find_mismatch_sse2(a + at, b + at, len - at);
+}
+
+SSE2 static size_t find_sse2(const char *src,
+                             size_t src_len,
+                             const char *needle,
+                             size_t len,
+                             size_t at)
+{
+	__m128i first = _mm_set1_epi8(needle[0]);
+	__m128i last = _mm_set1_epi8(needle[len - 1]);
+	for (; at + len - 1 + 16 <= src_len; at += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(src + at));
+		__m128i y = _mm_loadu_si128((const __m128i *)(src + at + len - 1));
+		uint32_t mask = _mm_movemask_epi8(
+			_mm_and_si128(_mm_cmpeq_epi8(x, first), _mm_cmpeq_epi8(y, last)));
+		for (; mask; mask &= mask - 1) {
+			size_t match = at + __builtin_ctz(mask);
+			if (!memcmp(src + match + 1, needle + 1, len - 2)) {
+				return match;
+			}
+		}
+	}
+	return find_scalar(src, src_len, needle, len, at);
+}
+
+AVX2 static size_t find_avx2(const char *src,
+                             size_t src_len,
+                             const char *needle,
+                             size_t len,
+                             size_t at)
+{
+	__m256i first = _mm256_set1_epi8(needle[0]);
+	__m256i last = _mm256_set1_epi8(needle[len - 1]);
+	for (; at + len - 1 + 32 <= src_len; at += 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(src + at));
+		__m256i y = _mm256_loadu_si256((const __m256i *)(src + at + len - 1));
+		uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(
+			_mm256_cmpeq_epi8(x, first), _mm256_cmpeq_epi8(y, last)));
+		for (; mask; mask &= mask - 1) {
+			size_t match = at + __builtin_ctz(mask);
+			if (!memcmp(src + match + 1, needle + 1, len - 2)) {
+				return match;
+			}
+		}
+	}
+	return find_sse2(src, src_len, needle, len, at);
+}
+
+#endif
+
+static size_t find_mismatch(const char *a, const char *b, size_t len)
+{
+	switch (lex_get_isa()) {
+#if WEFT_STR_HAS_X86
+	case WEFT_LEX_AVX2:
+		return find_mismatch_avx2(a, b, len);
+	case WEFT_LEX_SSE2:
+		return find_mismatch_sse2(a, b, len);
+#endif
+	default:
+		return find_mismatch_scalar(a, b, len);
+	}
+}
+
+static size_t find(const char *src,
+                   size_t src_len,
+                   const char *needle,
+                   size_t len,
+                   size_t at)
+{
+	if (!len) {
+		return at <= src_len ? at : WEFT_STR_NOT_FOUND;
+	} else if (len == 1) {
+		const char *match =
+			at < src_len ? memchr(src + at, needle[0], src_len - at) : NULL;
+		return match ? (size_t)(match - src) : WEFT_STR_NOT_FOUND;
+	}
+
+	switch (lex_get_isa()) {
+#if WEFT_STR_HAS_X86
+	case WEFT_LEX_AVX2:
+		return find_avx2(src, src_len, needle, len, at);
+	case WEFT_LEX_SSE2:
+		return find_sse2(src, src_len, needle, len, at);
+#endif
+	default:
+		return find_scalar(src, src_len, needle, len, at);
+	}
+}
+
+bool str_is_equal_n(const Weft_Str *str, const char *src, size_t len)
+{
+	return str->len == len && find_mismatch(str->ch, src, len) == len;
+}
+
+// Interned strings are unique, and cached hashes are only compared when
+// both sides already have one.
+bool str_is_equal(const Weft_Str *a, const Weft_Str *b)
+{
+	if (a == b) {
+		return true;
+	} else if (a->len != b->len || (a->sym && b->sym)
+	           || (a->hash && b->hash && a->hash != b->hash)) {
+		return false;
+	}
+	return find_mismatch(a->ch, b->ch, a->len) == a->len;
+}
+
+int str_compare(const Weft_Str *a, const Weft_Str *b)
+{
+	size_t len = a->len < b->len ? a->len : b->len;
+	size_t at = a == b ? len : find_mismatch(a->ch, b->ch, len);
+	if (at < len) {
+		return (uint8_t)a->ch[at] - (uint8_t)b->ch[at];
+	}
+	return (a->len > b->len) - (a->len < b->len);
+}
+
+// Returns the offset of the first match at or after from, or
+// WEFT_STR_NOT_FOUND.
+size_t
+str_find(const Weft_Str *str, const char *needle, size_t len, size_t from)
+{
+	return find(str->ch, str->len, needle, len, from);
+}
+
+// Counts matches that do not overlap. An empty needle never matches.
+size_t str_count(const Weft_Str *str, const char *needle, size_t len)
+{
+	size_t count = 0;
+	if (!len) {
+		return count;
+	}
+
+	size_t at = find(str->ch, str->len, needle, len, 0);
+	while (at != WEFT_STR_NOT_FOUND) {
+		count++;
+		at = find(str->ch, str->len, needle, len, at + len);
+	}
+	return count;
+}
+
+// Pushes an offset and a length for each part between separators, so no
+// string is allocated until a part is needed. Returns the part count.
+size_t str_split(const Weft_Str *str,
+                 const char *sep,
+                 size_t len,
+                 Weft_Buf **spans_p)
+{
+	size_t count = 0;
+	size_t start = 0;
+	size_t at = len ? find(str->ch, str->len, sep, len, 0)
+	                : WEFT_STR_NOT_FOUND;
+	while (at != WEFT_STR_NOT_FOUND) {
+		buf_push_size(spans_p, start);
+		buf_push_size(spans_p, at - start);
+		count++;
+		start = at + len;
+		at = find(str->ch, str->len, sep, len, start);
+	}
+
+	buf_push_size(spans_p, start);
+	buf_push_size(spans_p, str->len - start);
+	return count + 1;
+}
+
+Weft_Str *str_concat(Weft_Str *a, Weft_Str *b)
+{
+	gc_push_root(&a);
+	gc_push_root(&b);
+	Weft_Str *str = new_str(a->len + b->len);
+	gc_pop_roots(2);
+
+	memcpy(str->ch, a->ch, a->len);
+	memcpy(str->ch + a->len, b->ch, b->len);
+	return str;
+}
+
+// The result is sized by counting the matches first, then written once.
+// Returns str itself when nothing matches.
+Weft_Str *str_replace(Weft_Str *str, Weft_Str *from, Weft_Str *to)
+{
+	size_t count = str_count(str, from->ch, from->len);
+	if (!count) {
+		return str;
+	}
+
+	gc_push_root(&str);
+	gc_push_root(&from);
+	gc_push_root(&to);
+	Weft_Str *replaced =
+		new_str(str->len - count * from->len + count * to->len);
+	gc_pop_roots(3);
+
+	char *dest = replaced->ch;
+	size_t start = 0;
+	size_t at = find(str->ch, str->len, from->ch, from->len, 0);
+	while (at != WEFT_STR_NOT_FOUND) {
+		memcpy(dest, str->ch + start, at - start);
+		dest += at - start;
+		memcpy(dest, to->ch, to->len);
+		dest += to->len;
+		start = at + from->len;
+		at = find(str->ch, str->len, from->ch, from->len, start);
+	}
+	memcpy(dest, str->ch + start, str->len - start);
+	return replaced;
+}
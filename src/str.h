@@ -1,21 +1,52 @@
 #ifndef WEFT_STR_H
 #define WEFT_STR_H
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 // Forward Declarations
 
+typedef struct weft_arena Weft_Arena;
+typedef struct weft_buf Weft_Buf;
 typedef struct weft_str Weft_Str;
 
+// Constants
+
+static const size_t WEFT_STR_NOT_FOUND = SIZE_MAX;
+
 // Data Types
 
+// hash is computed on first use and is never 0 once set. sym is the
+// symbol ID of an interned string and 0 otherwise.
 struct weft_str {
 	size_t len;
+	uint32_t hash;
+	uint32_t sym;
 	char ch[];
 };
 
 // Functions
 
+Weft_Str *new_str(size_t len);
 Weft_Str *new_str_from_n(const char *src, size_t len);
+Weft_Str *
+new_arena_str_from_n(Weft_Arena *arena, const char *src, size_t len);
+Weft_Str *str_promote(const Weft_Str *str);
+bool str_is_utf8(const Weft_Str *str);
+uint32_t str_hash(const char *src, size_t len);
+uint32_t str_get_hash(Weft_Str *str);
+bool str_is_equal_n(const Weft_Str *str, const char *src, size_t len);
+bool str_is_equal(const Weft_Str *a, const Weft_Str *b);
+int str_compare(const Weft_Str *a, const Weft_Str *b);
+size_t
+str_find(const Weft_Str *str, const char *needle, size_t len, size_t from);
+size_t str_count(const Weft_Str *str, const char *needle, size_t len);
+size_t str_split(const Weft_Str *str,
+                 const char *sep,
+                 size_t len,
+                 Weft_Buf **spans_p);
+Weft_Str *str_concat(Weft_Str *a, Weft_Str *b);
+Weft_Str *str_replace(Weft_Str *str, Weft_Str *from, Weft_Str *to);
 
 #endif
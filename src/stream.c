@@ -0,0 +1,253 @@
+#include "stream.h"
+#include "arena.h"
+#include "buf.h"
+#include "gc.h"
+#include "lex.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Functions
+
+Weft_ParseStream *
+new_parse_stream(const char *path, Weft_ParseStreamFn emit, void *data)
+{
+	Weft_ParseStream *stream = malloc(sizeof(Weft_ParseStream));
+	if (!stream) {
+		exit(gc_error());
+	}
+
+	stream->file = new_parse_file(NULL, NULL);
+	stream->file->is_streamed = true;
+	gc_add_root(&stream->file);
+
+	size_t path_len = strlen(path);
+	stream->file->path = gc_alloc(path_len + 1);
+	memcpy(stream->file->path, path, path_len + 1);
+
+	stream->window = new_buf(WEFT_BUF_MIN_CAP);
+	buf_push_byte(&stream->window, '\0');
+	stream->start = 0;
+	stream->scan = 0;
+	stream->state = WEFT_PARSE_STREAM_START;
+	stream->emit = emit;
+	stream->data = data;
+
+	return stream;
+}
+
+void delete_parse_stream(Weft_ParseStream *stream)
+{
+	stream->file->src = NULL;
+	parse_file_release(stream->file);
+	gc_remove_root(&stream->file);
+	delete_buf(stream->window);
+	free(stream);
+}
+
+static Weft_ParseStreamState get_start_state(char c)
+{
+	switch (c) {
+	case '#':
+		return WEFT_PARSE_STREAM_COMMENT;
+	case '"':
+		return WEFT_PARSE_STREAM_STR;
+	case '\'':
+		return WEFT_PARSE_STREAM_CHAR;
+	case '@':
+		return WEFT_PARSE_STREAM_INCLUDE;
+	case '(':
+	case '[':
+	case '{':
+		return WEFT_PARSE_STREAM_SINGLE;
+	default:
+		if (lex_is(c, WEFT_LEX_DELIM)) {
+			return WEFT_PARSE_STREAM_SINGLE;
+		}
+		return WEFT_PARSE_STREAM_WORD;
+	}
+}
+
+// Runs the state machine from scan towards end, and returns true once the
+// window holds every byte that parse_token reads for the pending token.
+// Each state only needs the current byte, so a token split across chunks
+// resumes where the last chunk left it.
+static bool scan_token(Weft_ParseStream *stream, const char *src, size_t end)
+{
+	Weft_ParseStreamState state = stream->state;
+	size_t at = stream->scan;
+	bool is_done = state == WEFT_PARSE_STREAM_SINGLE;
+	while (!is_done && at < end) {
+		char c = src[at];
+		switch (state) {
+		case WEFT_PARSE_STREAM_WORD:
+			at += lex_find_delim(src + at);
+			is_done = at < end;
+			break;
+		case WEFT_PARSE_STREAM_COMMENT:
+			at += lex_find_line_end(src + at);
+			is_done = at < end;
+			break;
+		case WEFT_PARSE_STREAM_STR:
+			if (c == '\\') {
+				state = WEFT_PARSE_STREAM_STR_ESC;
+			}
+			is_done = c == '"' || !c;
+			at++;
+			break;
+		case WEFT_PARSE_STREAM_STR_ESC:
+			state = WEFT_PARSE_STREAM_STR;
+			at++;
+			break;
+		case WEFT_PARSE_STREAM_CHAR:
+			state = c == '\\' ? WEFT_PARSE_STREAM_CHAR_ESC
+			                  : WEFT_PARSE_STREAM_CHAR_END;
+			at++;
+			break;
+		case WEFT_PARSE_STREAM_CHAR_ESC:
+			state = WEFT_PARSE_STREAM_CHAR_END;
+			at++;
+			break;
+		case WEFT_PARSE_STREAM_CHAR_END:
+			is_done = c == '\'' || lex_is(c, WEFT_LEX_LINE_END);
+			at++;
+			break;
+		case WEFT_PARSE_STREAM_INCLUDE:
+			state = WEFT_PARSE_STREAM_INCLUDE_BODY;
+			is_done = c != '(';
+			at++;
+			break;
+		case WEFT_PARSE_STREAM_INCLUDE_BODY:
+			if (c == '"') {
+				state = WEFT_PARSE_STREAM_INCLUDE_STR;
+			} else if (c == '#') {
+				state = WEFT_PARSE_STREAM_INCLUDE_COMMENT;
+			}
+			is_done = c == ')' || !c;
+			at++;
+			break;
+		case WEFT_PARSE_STREAM_INCLUDE_COMMENT:
+			if (c == '\n') {
+				state = WEFT_PARSE_STREAM_INCLUDE_BODY;
+			}
+			is_done = !c;
+			at++;
+			break;
+		case WEFT_PARSE_STREAM_INCLUDE_STR:
+			if (c == '\\') {
+				state = WEFT_PARSE_STREAM_INCLUDE_STR_ESC;
+			} else if (c == '"') {
+				state = WEFT_PARSE_STREAM_INCLUDE_BODY;
+			}
+			is_done = !c;
+			at++;
+			break;
+		case WEFT_PARSE_STREAM_INCLUDE_STR_ESC:
+			state = WEFT_PARSE_STREAM_INCLUDE_STR;
+			at++;
+			break;
+		default:
+			is_done = true;
+			break;
+		}
+	}
+
+	stream->state = state;
+	stream->scan = at;
+	return is_done;
+}
+
+// Drops the consumed input from the window and moves the file's base to
+// the position of the first byte kept.
+static void compact(Weft_ParseStream *stream)
+{
+	Weft_ParseFile *file = stream->file;
+	char *src = buf_get_raw(stream->window);
+	size_t end = buf_get_at(stream->window) - 1;
+	size_t start = stream->start < end ? stream->start : end;
+	if (!start) {
+		return;
+	}
+
+	for (size_t at = 0; at < start;) {
+		size_t len = lex_find_line_end(src + at);
+		if (at + len >= start) {
+			file->base.col += start - at;
+			break;
+		}
+
+		at += len + 1;
+		if (src[at - 1] == '\n') {
+			file->base.line++;
+			file->base.col = 0;
+		} else {
+			file->base.col += len + 1;
+		}
+	}
+
+	memmove(src, src + start, end + 1 - start);
+	buf_drop(&stream->window, start);
+	buf_trim(&stream->window);
+	stream->scan -= start;
+	stream->start = 0;
+
+	file->src = buf_get_raw(stream->window);
+	if (file->lines) {
+		delete_buf(file->lines);
+		file->lines = NULL;
+	}
+}
+
+static void drain(Weft_ParseStream *stream, bool is_final)
+{
+	Weft_ParseFile *file = stream->file;
+	char *src = buf_get_raw(stream->window);
+	size_t end = buf_get_at(stream->window) - 1;
+	if (file->src != src && file->lines) {
+		delete_buf(file->lines);
+		file->lines = NULL;
+	}
+	file->src = src;
+
+	while (true) {
+		if (stream->state == WEFT_PARSE_STREAM_START) {
+			stream->start += lex_skip_space(src + stream->start);
+			if (stream->start >= end) {
+				break;
+			}
+			stream->scan = stream->start + 1;
+			stream->state = get_start_state(src[stream->start]);
+		}
+
+		if (!scan_token(stream, src, end) && !is_final) {
+			break;
+		}
+
+		if (stream->state == WEFT_PARSE_STREAM_COMMENT) {
+			stream->start = stream->scan;
+		} else {
+			Weft_ParseToken token = parse_token(file, src + stream->start);
+			stream->start += token.len ? token.len : 1;
+			stream->emit(token, stream->data);
+		}
+		stream->state = WEFT_PARSE_STREAM_START;
+	}
+
+	arena_reset(file->arena);
+	compact(stream);
+}
+
+void parse_stream_feed(Weft_ParseStream *stream, const char *chunk, size_t size)
+{
+	buf_drop(&stream->window, 1);
+	buf_push(&stream->window, chunk, size);
+	buf_push_byte(&stream->window, '\0');
+	drain(stream, false);
+}
+
+// Parses whatever is left in the window as if the input ended there.
+void parse_stream_finish(Weft_ParseStream *stream)
+{
+	drain(stream, true);
+}
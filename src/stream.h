@@ -0,0 +1,57 @@
+#ifndef WEFT_STREAM_H
+#define WEFT_STREAM_H
+
+#include "parse.h"
+
+#include <stddef.h>
+
+// Forward Declarations
+
+typedef struct weft_buf Weft_Buf;
+typedef enum weft_parse_stream_state Weft_ParseStreamState;
+typedef struct weft_parse_stream Weft_ParseStream;
+typedef void (*Weft_ParseStreamFn)(Weft_ParseToken token, void *data);
+
+// Data Types
+
+enum weft_parse_stream_state {
+	WEFT_PARSE_STREAM_START,
+	WEFT_PARSE_STREAM_SINGLE,
+	WEFT_PARSE_STREAM_WORD,
+	WEFT_PARSE_STREAM_COMMENT,
+	WEFT_PARSE_STREAM_STR,
+	WEFT_PARSE_STREAM_STR_ESC,
+	WEFT_PARSE_STREAM_CHAR,
+	WEFT_PARSE_STREAM_CHAR_ESC,
+	WEFT_PARSE_STREAM_CHAR_END,
+	WEFT_PARSE_STREAM_INCLUDE,
+	WEFT_PARSE_STREAM_INCLUDE_BODY,
+	WEFT_PARSE_STREAM_INCLUDE_COMMENT,
+	WEFT_PARSE_STREAM_INCLUDE_STR,
+	WEFT_PARSE_STREAM_INCLUDE_STR_ESC,
+};
+
+// The window holds the input from the start of the pending token onwards,
+// and scan is how far the state machine has read into it. A token is only
+// parsed once its end is in the window, so the window never holds more
+// than the largest token plus the last chunk. Emitted tokens point into
+// the window and the file's arena, so they are only valid during emit.
+struct weft_parse_stream {
+	Weft_ParseFile *file;
+	Weft_Buf *window;
+	size_t start;
+	size_t scan;
+	Weft_ParseStreamState state;
+	Weft_ParseStreamFn emit;
+	void *data;
+};
+
+// Functions
+
+Weft_ParseStream *
+new_parse_stream(const char *path, Weft_ParseStreamFn emit, void *data);
+void delete_parse_stream(Weft_ParseStream *stream);
+void parse_stream_feed(Weft_ParseStream *stream, const char *chunk, size_t size);
+void parse_stream_finish(Weft_ParseStream *stream);
+
+#endif
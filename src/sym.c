@@ -0,0 +1,195 @@
+#include "sym.h"
+#include "buf.h"
+#include "gc.h"
+#include "str.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Globals
+
+// The lock is never held across an allocation, since a thread waiting on
+// it could not reach the safepoint a collection waits for. Collections
+// visit the table with every other thread parked outside the lock.
+static Weft_SymTable g_table;
+static pthread_mutex_t g_table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Functions
+
+static Weft_SymSlot *new_slots(size_t cap)
+{
+	Weft_SymSlot *slots = calloc(cap, sizeof(Weft_SymSlot));
+	if (!slots) {
+		exit(gc_error());
+	}
+	return slots;
+}
+
+static void visit_table(Weft_GCVisitFn visit)
+{
+	Weft_SymSlot *slots = g_table.slots;
+	for (size_t i = 0; i < g_table.cap; i++) {
+		if (slots[i].str) {
+			visit(&slots[i].str);
+		}
+	}
+
+	Weft_Str **strs = buf_get_raw(g_table.strs);
+	size_t count = buf_get_at(g_table.strs) / sizeof(Weft_Str *);
+	for (size_t sym = 1; sym < count; sym++) {
+		if (strs[sym]) {
+			visit(&strs[sym]);
+		}
+	}
+
+	for (size_t i = 0; i < g_table.cap; i++) {
+		if (!slots[i].str && slots[i].sym) {
+			buf_push(&g_table.free_syms, &slots[i].sym, sizeof(Weft_Sym));
+			slots[i].sym = WEFT_SYM_NONE;
+			g_table.live--;
+		}
+	}
+}
+
+static void init_table(void)
+{
+	g_table.slots = new_slots(WEFT_SYM_MIN_CAP);
+	g_table.cap = WEFT_SYM_MIN_CAP;
+	g_table.strs = new_buf(WEFT_BUF_MIN_CAP);
+	g_table.free_syms = new_buf(WEFT_BUF_MIN_CAP);
+	buf_push_ptr(&g_table.strs, NULL);
+	gc_add_weak(visit_table);
+}
+
+static Weft_SymSlot *find_slot(uint32_t hash, const char *src, size_t len)
+{
+	size_t mask = g_table.cap - 1;
+	for (size_t i = hash & mask;; i = (i + 1) & mask) {
+		Weft_SymSlot *slot = &g_table.slots[i];
+		if (!slot->hash) {
+			return NULL;
+		} else if (slot->hash == hash && slot->str
+		           && str_is_equal_n(slot->str, src, len)) {
+			return slot;
+		}
+	}
+}
+
+static Weft_SymSlot *find_free_slot(uint32_t hash)
+{
+	size_t mask = g_table.cap - 1;
+	for (size_t i = hash & mask;; i = (i + 1) & mask) {
+		Weft_SymSlot *slot = &g_table.slots[i];
+		if (!slot->str) {
+			return slot;
+		}
+	}
+}
+
+// Rehashes the live symbols into a table sized for them, which also drops
+// every tombstone.
+static void resize_table(void)
+{
+	size_t cap = WEFT_SYM_MIN_CAP;
+	while ((double)(g_table.live + 1) > cap * WEFT_SYM_MAX_LOAD / 2) {
+		cap *= 2;
+	}
+
+	Weft_SymSlot *old_slots = g_table.slots;
+	size_t old_cap = g_table.cap;
+	g_table.slots = new_slots(cap);
+	g_table.cap = cap;
+	g_table.used = g_table.live;
+	for (size_t i = 0; i < old_cap; i++) {
+		if (old_slots[i].str) {
+			*find_free_slot(old_slots[i].hash) = old_slots[i];
+		}
+	}
+	free(old_slots);
+}
+
+static Weft_Sym new_sym(Weft_Str *str)
+{
+	if (buf_get_at(g_table.free_syms)) {
+		Weft_Sym sym;
+		buf_pop(&sym, &g_table.free_syms, sizeof(Weft_Sym));
+		Weft_Str **strs = buf_get_raw(g_table.strs);
+		strs[sym] = str;
+		return sym;
+	}
+
+	Weft_Sym sym = buf_get_at(g_table.strs) / sizeof(Weft_Str *);
+	buf_push_ptr(&g_table.strs, str);
+	return sym;
+}
+
+static Weft_Str *insert(Weft_Str *str, uint32_t hash)
+{
+	if ((double)(g_table.used + 1) > g_table.cap * WEFT_SYM_MAX_LOAD) {
+		resize_table();
+	}
+
+	str->hash = hash;
+	str->sym = new_sym(str);
+	Weft_SymSlot *slot = find_free_slot(hash);
+	if (!slot->hash) {
+		g_table.used++;
+	}
+	*slot = (Weft_SymSlot){str, hash, str->sym};
+	g_table.live++;
+	return str;
+}
+
+// Returns the one string holding the text of src. The text is copied
+// before allocating, since a collection may move the source, and looked
+// up again afterwards, since another thread may have interned it.
+Weft_Str *sym_intern(const char *src, size_t len)
+{
+	uint32_t hash = str_hash(src, len);
+	pthread_mutex_lock(&g_table_lock);
+	if (!g_table.slots) {
+		init_table();
+	}
+
+	Weft_SymSlot *slot = find_slot(hash, src, len);
+	Weft_Str *str = slot ? slot->str : NULL;
+	pthread_mutex_unlock(&g_table_lock);
+	if (str) {
+		return str;
+	}
+
+	char small[64];
+	char *copy = small;
+	if (len > sizeof(small) && !(copy = malloc(len))) {
+		exit(gc_error());
+	}
+	memcpy(copy, src, len);
+	str = new_str_from_n(copy, len);
+	if (copy != small) {
+		free(copy);
+	}
+
+	pthread_mutex_lock(&g_table_lock);
+	slot = find_slot(hash, str->ch, len);
+	str = slot ? slot->str : insert(str, hash);
+	pthread_mutex_unlock(&g_table_lock);
+	return str;
+}
+
+Weft_Str *sym_get_str(Weft_Sym sym)
+{
+	pthread_mutex_lock(&g_table_lock);
+	Weft_Str **strs = buf_get_raw(g_table.strs);
+	Weft_Str *str = strs[sym];
+	pthread_mutex_unlock(&g_table_lock);
+	return str;
+}
+
+size_t sym_get_count(void)
+{
+	pthread_mutex_lock(&g_table_lock);
+	size_t count = g_table.live;
+	pthread_mutex_unlock(&g_table_lock);
+	return count;
+}
@@ -0,0 +1,49 @@
+#ifndef WEFT_SYM_H
+#define WEFT_SYM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Forward Declarations
+
+typedef struct weft_buf Weft_Buf;
+typedef struct weft_str Weft_Str;
+typedef uint32_t Weft_Sym;
+typedef struct weft_sym_slot Weft_SymSlot;
+typedef struct weft_sym_table Weft_SymTable;
+
+// Constants
+
+static const size_t WEFT_SYM_MIN_CAP = 256;
+static const double WEFT_SYM_MAX_LOAD = 0.75;
+static const Weft_Sym WEFT_SYM_NONE = 0;
+
+// Data Types
+
+// An empty slot has a hash of 0. A slot whose string was collected keeps
+// its hash as a tombstone so probing continues past it.
+struct weft_sym_slot {
+	Weft_Str *str;
+	uint32_t hash;
+	Weft_Sym sym;
+};
+
+// The slots and strs only hold weak references, so a symbol lives as long
+// as its string is reachable. The IDs of collected symbols are reused to
+// keep them dense.
+struct weft_sym_table {
+	Weft_SymSlot *slots;
+	size_t cap;
+	size_t used;
+	size_t live;
+	Weft_Buf *strs;
+	Weft_Buf *free_syms;
+};
+
+// Functions
+
+Weft_Str *sym_intern(const char *src, size_t len);
+Weft_Str *sym_get_str(Weft_Sym sym);
+size_t sym_get_count(void);
+
+#endif
@@ -0,0 +1,160 @@
+#include "token.h"
+#include "buf.h"
+#include "gc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Functions
+
+static bool has_payload(Weft_ParseType type)
+{
+	switch (type) {
+	case WEFT_PARSE_CHAR:
+	case WEFT_PARSE_STR:
+	case WEFT_PARSE_NUM:
+	case WEFT_PARSE_WORD:
+	case WEFT_PARSE_INCLUDE:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static void push_u32(Weft_Buf **buf_p, uint32_t value)
+{
+	buf_push(buf_p, &value, sizeof(uint32_t));
+}
+
+static void push_token(Weft_TokenStream *stream, Weft_ParseToken token)
+{
+	if (has_payload(token.type)) {
+		push_u32(&stream->payload_ids, token_stream_get_count(stream));
+		buf_push(&stream->payloads, &token.num, sizeof(token.num));
+	}
+
+	push_u32(&stream->offsets, token.src - stream->file->src);
+	push_u32(&stream->lens, token.len);
+	buf_push_byte(&stream->types, token.type);
+}
+
+// Tokenizes the whole file. Returns NULL if the source is too large for
+// 32-bit offsets.
+Weft_TokenStream *new_token_stream(Weft_ParseFile *file)
+{
+	Weft_TokenStream *stream = malloc(sizeof(Weft_TokenStream));
+	if (!stream) {
+		exit(gc_error());
+	}
+
+	stream->file = file;
+	gc_add_root(&stream->file);
+	stream->offsets = new_buf(WEFT_BUF_MIN_CAP);
+	stream->lens = new_buf(WEFT_BUF_MIN_CAP);
+	stream->types = new_buf(WEFT_BUF_MIN_CAP);
+	stream->payload_ids = new_buf(WEFT_BUF_MIN_CAP);
+	stream->payloads = new_buf(WEFT_BUF_MIN_CAP);
+
+	const char *src = file->src;
+	size_t at = parse_empty(file, src).len;
+	while (src[at]) {
+		Weft_ParseToken token = parse_token(file, src + at);
+		if (at + token.len > UINT32_MAX) {
+			delete_token_stream(stream);
+			return NULL;
+		}
+
+		push_token(stream, token);
+		at += token.len ? token.len : 1;
+		at += parse_empty(file, src + at).len;
+	}
+	return stream;
+}
+
+void delete_token_stream(Weft_TokenStream *stream)
+{
+	gc_remove_root(&stream->file);
+	delete_buf(stream->offsets);
+	delete_buf(stream->lens);
+	delete_buf(stream->types);
+	delete_buf(stream->payload_ids);
+	delete_buf(stream->payloads);
+	free(stream);
+}
+
+size_t token_stream_get_count(const Weft_TokenStream *stream)
+{
+	return buf_get_at(stream->types);
+}
+
+const uint32_t *token_stream_get_offsets(Weft_TokenStream *stream)
+{
+	return buf_get_raw(stream->offsets);
+}
+
+const uint32_t *token_stream_get_lens(Weft_TokenStream *stream)
+{
+	return buf_get_raw(stream->lens);
+}
+
+const uint8_t *token_stream_get_types(Weft_TokenStream *stream)
+{
+	return buf_get_raw(stream->types);
+}
+
+static Weft_ParseToken
+get_token(Weft_TokenStream *stream, size_t index, size_t payload)
+{
+	const uint32_t *offsets = buf_get_raw(stream->offsets);
+	const uint32_t *lens = buf_get_raw(stream->lens);
+	const uint8_t *types = buf_get_raw(stream->types);
+	Weft_ParseToken token = new_parse_token(
+		stream->file, stream->file->src + offsets[index], lens[index]);
+	token.type = types[index];
+
+	if (has_payload(token.type)) {
+		const char *payloads = buf_get_raw(stream->payloads);
+		memcpy(&token.num,
+		       payloads + payload * sizeof(token.num),
+		       sizeof(token.num));
+	}
+	return token;
+}
+
+// Finds the payload slot of a token by binary search over payload_ids.
+static size_t find_payload(Weft_TokenStream *stream, size_t index)
+{
+	const uint32_t *ids = buf_get_raw(stream->payload_ids);
+	size_t low = 0;
+	size_t high = buf_get_at(stream->payload_ids) / sizeof(uint32_t);
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+		if (ids[mid] < index) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	return low;
+}
+
+Weft_ParseToken token_stream_get(Weft_TokenStream *stream, size_t index)
+{
+	return get_token(stream, index, find_payload(stream, index));
+}
+
+bool token_stream_next(Weft_TokenStream *stream,
+                       Weft_TokenCursor *cursor,
+                       Weft_ParseToken *token_p)
+{
+	if (cursor->index >= token_stream_get_count(stream)) {
+		return false;
+	}
+
+	*token_p = get_token(stream, cursor->index, cursor->payload);
+	if (has_payload(token_p->type)) {
+		cursor->payload++;
+	}
+	cursor->index++;
+	return true;
+}
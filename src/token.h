@@ -0,0 +1,50 @@
+#ifndef WEFT_TOKEN_H
+#define WEFT_TOKEN_H
+
+#include "parse.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Forward Declarations
+
+typedef struct weft_buf Weft_Buf;
+typedef struct weft_token_stream Weft_TokenStream;
+typedef struct weft_token_cursor Weft_TokenCursor;
+
+// Data Types
+
+// Tokens are stored as parallel arrays of uint32_t offsets into the file,
+// uint32_t lengths and uint8_t types. Chars, strings, numbers, words and
+// includes also get a slot in payloads, and payload_ids holds the token index of
+// each slot in order.
+struct weft_token_stream {
+	Weft_ParseFile *file;
+	Weft_Buf *offsets;
+	Weft_Buf *lens;
+	Weft_Buf *types;
+	Weft_Buf *payload_ids;
+	Weft_Buf *payloads;
+};
+
+// A cursor walks the stream in order without searching for payloads.
+struct weft_token_cursor {
+	size_t index;
+	size_t payload;
+};
+
+// Functions
+
+Weft_TokenStream *new_token_stream(Weft_ParseFile *file);
+void delete_token_stream(Weft_TokenStream *stream);
+size_t token_stream_get_count(const Weft_TokenStream *stream);
+const uint32_t *token_stream_get_offsets(Weft_TokenStream *stream);
+const uint32_t *token_stream_get_lens(Weft_TokenStream *stream);
+const uint8_t *token_stream_get_types(Weft_TokenStream *stream);
+Weft_ParseToken token_stream_get(Weft_TokenStream *stream, size_t index);
+bool token_stream_next(Weft_TokenStream *stream,
+                       Weft_TokenCursor *cursor,
+                       Weft_ParseToken *token_p);
+
+#endif
@@ -0,0 +1,270 @@
+#include "utf8.h"
+#include "lex.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define WEFT_UTF8_HAS_X86 1
+#include <immintrin.h>
+#else
+#define WEFT_UTF8_HAS_X86 0
+#endif
+
+// Functions
+
+static bool is_cont(uint8_t c)
+{
+	return (c & 0xc0) == 0x80;
+}
+
+// Returns the length of the well-formed sequence at src, or 0 if there is
+// none. The second byte range excludes overlongs, surrogates and values
+// past U+10FFFF.
+static size_t get_seq_len(const uint8_t *src, size_t len)
+{
+	uint8_t c = src[0];
+	uint8_t low = 0x80;
+	uint8_t high = 0xbf;
+	size_t seq_len;
+	if (c < 0x80) {
+		return 1;
+	} else if (c >= 0xc2 && c <= 0xdf) {
+		seq_len = 2;
+	} else if (c >= 0xe0 && c <= 0xef) {
+		seq_len = 3;
+		low = c == 0xe0 ? 0xa0 : low;
+		high = c == 0xed ? 0x9f : high;
+	} else if (c >= 0xf0 && c <= 0xf4) {
+		seq_len = 4;
+		low = c == 0xf0 ? 0x90 : low;
+		high = c == 0xf4 ? 0x8f : high;
+	} else {
+		return 0;
+	}
+
+	if (len < seq_len || src[1] < low || src[1] > high) {
+		return 0;
+	}
+	for (size_t i = 2; i < seq_len; i++) {
+		if (!is_cont(src[i])) {
+			return 0;
+		}
+	}
+	return seq_len;
+}
+
+static size_t find_invalid_scalar(const uint8_t *src, size_t at, size_t len)
+{
+	while (at < len) {
+		size_t seq_len = get_seq_len(src + at, len - at);
+		if (!seq_len) {
+			return at;
+		}
+		at += seq_len;
+	}
+	return len;
+}
+
+// Every sequence before block is known to be valid, so a sequence crossing
+// into it starts at the first non-continuation byte of the three before.
+static size_t
+find_invalid_from_block(const uint8_t *src, size_t block, size_t len)
+{
+	size_t at = block < 3 ? 0 : block - 3;
+	while (at < block && is_cont(src[at])) {
+		at++;
+	}
+	return find_invalid_scalar(src, at, len);
+}
+
+#if WEFT_UTF8_HAS_X86
+
+#define SSE2 __attribute__((target("sse2")))
+
+// Skips ASCII sixteen bytes at a time and checks the rest per sequence.
+SSE2 static size_t find_invalid_sse2(const uint8_t *src, size_t len)
+{
+	size_t at = 0;
+	while (at < len) {
+		if (len - at >= 16
+		    && !_mm_movemask_epi8(
+			    _mm_loadu_si128((const __m128i *)(src + at)))) {
+			at += 16;
+			continue;
+		}
+
+		size_t seq_len = get_seq_len(src + at, len - at);
+		if (!seq_len) {
+			return at;
+		}
+		at += seq_len;
+	}
+	return len;
+}
+
+#define AVX2 __attribute__((target("avx2")))
+
+#define TOO_SHORT (1 << 0)
+#define TOO_LONG (1 << 1)
+#define OVERLONG_3 (1 << 2)
+#define TOO_LARGE (1 << 3)
+#define SURROGATE (1 << 4)
+#define OVERLONG_2 (1 << 5)
+#define TOO_LARGE_1000 (1 << 6)
+#define OVERLONG_4 (1 << 6)
+#define TWO_CONTS (1 << 7)
+#define CARRY (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+AVX2 static inline __m256i avx2_table(const int8_t table[16])
+{
+	return _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((const __m128i *)table));
+}
+
+AVX2 static inline __m256i avx2_high_nibble(__m256i x)
+{
+	return _mm256_and_si256(_mm256_srli_epi16(x, 4), _mm256_set1_epi8(0x0f));
+}
+
+AVX2 static inline __m256i avx2_prev(__m256i x, __m256i prev_x, int n)
+{
+	__m256i joined = _mm256_permute2x128_si256(prev_x, x, 0x21);
+	switch (n) {
+	case 1:
+		return _mm256_alignr_epi8(x, joined, 15);
+	case 2:
+		return _mm256_alignr_epi8(x, joined, 14);
+	default:
+		return _mm256_alignr_epi8(x, joined, 13);
+	}
+}
+
+// Classifies each pair of adjacent bytes by the high nibble of the first,
+// the low nibble of the first and the high nibble of the second. A bit
+// survives the AND only for an invalid pair, except TWO_CONTS, which has
+// to match the bytes that three and four byte sequences expect.
+AVX2 static inline __m256i avx2_check_block(__m256i x, __m256i prev_x)
+{
+	static const int8_t BYTE_1_HIGH[16] = {
+		TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+		TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+		TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+		TOO_SHORT | OVERLONG_2,
+		TOO_SHORT,
+		TOO_SHORT | OVERLONG_3 | SURROGATE,
+		TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4,
+	};
+	static const int8_t BYTE_1_LOW[16] = {
+		CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+		CARRY | OVERLONG_2,
+		CARRY,
+		CARRY,
+		CARRY | TOO_LARGE,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+	};
+	static const int8_t BYTE_2_HIGH[16] = {
+		TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+		TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+		TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000
+			| OVERLONG_4,
+		TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+		TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+		TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+		TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+	};
+
+	__m256i prev1 = avx2_prev(x, prev_x, 1);
+	__m256i byte_1_high =
+		_mm256_shuffle_epi8(avx2_table(BYTE_1_HIGH), avx2_high_nibble(prev1));
+	__m256i byte_1_low = _mm256_shuffle_epi8(
+		avx2_table(BYTE_1_LOW), _mm256_and_si256(prev1, _mm256_set1_epi8(0x0f)));
+	__m256i byte_2_high =
+		_mm256_shuffle_epi8(avx2_table(BYTE_2_HIGH), avx2_high_nibble(x));
+	__m256i special = _mm256_and_si256(
+		_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+
+	__m256i third = _mm256_subs_epu8(
+		avx2_prev(x, prev_x, 2), _mm256_set1_epi8((char)(0xe0 - 0x80)));
+	__m256i fourth = _mm256_subs_epu8(
+		avx2_prev(x, prev_x, 3), _mm256_set1_epi8((char)(0xf0 - 0x80)));
+	__m256i must_be_cont = _mm256_and_si256(
+		_mm256_or_si256(third, fourth), _mm256_set1_epi8((char)0x80));
+	return _mm256_xor_si256(special, must_be_cont);
+}
+
+// Non-zero where a sequence starting in the last three bytes would need
+// more bytes than the block has left.
+AVX2 static inline __m256i avx2_incomplete(__m256i x)
+{
+	const __m256i max = _mm256_setr_epi8(
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		(char)(0xf0 - 1), (char)(0xe0 - 1), (char)(0xc0 - 1));
+	return _mm256_subs_epu8(x, max);
+}
+
+// The lookup validator from simdjson. Blocks are checked whole, and a
+// flagged block is rescanned per sequence for the exact offset.
+AVX2 static size_t find_invalid_avx2(const uint8_t *src, size_t len)
+{
+	__m256i prev_x = _mm256_setzero_si256();
+	__m256i prev_incomplete = _mm256_setzero_si256();
+	uint8_t tail[32];
+	for (size_t at = 0; at < len; at += 32) {
+		__m256i x;
+		if (len - at >= 32) {
+			x = _mm256_loadu_si256((const __m256i *)(src + at));
+		} else {
+			memset(tail, 0, sizeof(tail));
+			memcpy(tail, src + at, len - at);
+			x = _mm256_loadu_si256((const __m256i *)tail);
+		}
+
+		__m256i error;
+		if (!_mm256_movemask_epi8(x)) {
+			error = prev_incomplete;
+		} else {
+			error = avx2_check_block(x, prev_x);
+		}
+
+		if (!_mm256_testz_si256(error, error)) {
+			return find_invalid_from_block(src, at, len);
+		}
+		prev_incomplete = avx2_incomplete(x);
+		prev_x = x;
+	}
+
+	if (!_mm256_testz_si256(prev_incomplete, prev_incomplete)) {
+		return find_invalid_from_block(src, len - 32, len);
+	}
+	return len;
+}
+
+#endif
+
+// Returns the offset of the first byte that does not start a well-formed
+// sequence, or len if the whole input is valid.
+size_t utf8_find_invalid(const char *src, size_t len)
+{
+	const uint8_t *bytes = (const uint8_t *)src;
+	switch (lex_get_isa()) {
+#if WEFT_UTF8_HAS_X86
+	case WEFT_LEX_AVX2:
+		return find_invalid_avx2(bytes, len);
+	case WEFT_LEX_SSE2:
+		return find_invalid_sse2(bytes, len);
+#endif
+	default:
+		return find_invalid_scalar(bytes, 0, len);
+	}
+}
@@ -0,0 +1,30 @@
+#ifndef WEFT_UTF8_H
+#define WEFT_UTF8_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Constants
+
+static const uint32_t WEFT_UTF8_MAX = 0x10ffff;
+static const uint32_t WEFT_UTF8_SURROGATE_MIN = 0xd800;
+static const uint32_t WEFT_UTF8_SURROGATE_MAX = 0xdfff;
+static const uint32_t WEFT_UTF8_REPLACEMENT = 0xfffd;
+
+// Functions
+
+size_t utf8_find_invalid(const char *src, size_t len);
+
+static inline bool utf8_is_valid(const char *src, size_t len)
+{
+	return utf8_find_invalid(src, len) == len;
+}
+
+static inline bool utf8_is_scalar(uint32_t c)
+{
+	return c <= WEFT_UTF8_MAX
+	    && (c < WEFT_UTF8_SURROGATE_MIN || c > WEFT_UTF8_SURROGATE_MAX);
+}
+
+#endif